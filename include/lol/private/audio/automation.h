@@ -0,0 +1,387 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Parameter automation
+// ————————————————————
+// Parameters that change over time are described by a queue of events and
+// evaluated once per block into a dense control buffer, so that streams can
+// apply them sample-accurately without per-sample branches or calls.
+//
+
+#include <algorithm> // std::fill, std::upper_bound
+#include <cassert> // assert()
+#include <cmath> // std::pow, std::cos, std::sin
+#include <cstdint> // uint8_t
+#include <memory> // std::shared_ptr
+#include <optional> // std::optional
+#include <type_traits> // std::is_same_v
+#include <vector> // std::vector
+
+#include "../math/constants.h" // F_PI_4, F_SQRT_2
+#include "stream.h" // lol::audio::stream
+#include "sample.h" // lol::audio::sample
+
+namespace lol::audio
+{
+
+// An automatable parameter. Events are scheduled at absolute frame positions
+// on the timeline of the stream that owns the parameter:
+//  - set_at() jumps to a value at a given frame,
+//  - linear_to() and exponential_to() ramp from the previous event (or from
+//    the current value if there is none) so that the value is reached at the
+//    given frame.
+// Exponential ramps need both ends to be non-zero with the same sign; they
+// fall back to linear ramps otherwise.
+//
+// Like the other stream controls, scheduling is not thread-safe and should
+// happen on the thread that renders the owning stream.
+template<typename F = float>
+class param
+{
+public:
+    param(F value = F(0))
+      : m_value(value),
+        m_start_value(value)
+    {}
+
+    // Cancel all events and jump to a value immediately
+    void set(F value)
+    {
+        m_events.clear();
+        m_value = m_start_value = value;
+        m_start_frame = m_frame;
+    }
+
+    void set_at(F value, size_t frame) { schedule(event::type::set, value, frame); }
+    void linear_to(F value, size_t frame) { schedule(event::type::linear, value, frame); }
+    void exponential_to(F value, size_t frame) { schedule(event::type::exponential, value, frame); }
+
+    // Cancel all events scheduled at or after the given frame
+    void cancel(size_t frame = 0)
+    {
+        auto it = std::lower_bound(m_events.begin(), m_events.end(), frame,
+                                   [](event const &e, size_t f) { return e.frame < f; });
+        m_events.erase(it, m_events.end());
+    }
+
+    // Reserve room for this many pending events so that scheduling does
+    // not allocate
+    void reserve(size_t count) { m_events.reserve(count); }
+
+    inline F value() const { return m_value; }
+    inline size_t frame() const { return m_frame; }
+    inline size_t pending() const { return m_events.size(); }
+
+    // Evaluate the next frames into out, and advance. If out is null the
+    // parameter is only advanced. Returns true when the value was constant
+    // over the whole block, in which case callers may use value() instead
+    // of the buffer.
+    bool render(F *out, size_t frames)
+    {
+        bool constant = true;
+
+        for (size_t n = 0; n < frames; )
+        {
+            // Apply events that have been reached
+            while (!m_events.empty() && m_events.front().frame <= m_frame)
+            {
+                constant &= m_events.front().value == m_value || n == 0;
+                m_value = m_start_value = m_events.front().value;
+                m_start_frame = m_frame;
+                m_events.erase(m_events.begin());
+            }
+
+            if (m_events.empty())
+            {
+                if (out)
+                    std::fill(out + n, out + frames, m_value);
+                m_frame += frames - n;
+                m_start_frame = m_frame;
+                break;
+            }
+
+            event const &e = m_events.front();
+            size_t const count = std::min(frames - n, e.frame - m_frame);
+            size_t const length = e.frame - m_start_frame;
+
+            if (e.kind == event::type::set)
+            {
+                if (out)
+                    std::fill(out + n, out + n + count, m_value);
+            }
+            else if (e.kind == event::type::exponential && m_start_value * e.value > F(0))
+            {
+                // Multiplicative step, resynchronised at every block
+                F const ratio = e.value / m_start_value;
+                F const step = F(std::pow(ratio, F(1) / F(length)));
+                F x = m_start_value * F(std::pow(ratio, F(m_frame - m_start_frame) / F(length)));
+                if (out)
+                    for (size_t i = 0; i < count; ++i, x *= step)
+                        out[n + i] = x;
+                m_value = m_start_value * F(std::pow(ratio, F(m_frame + count - m_start_frame) / F(length)));
+                constant = false;
+            }
+            else
+            {
+                F const delta = (e.value - m_start_value) / F(length);
+                if (out)
+                    for (size_t i = 0; i < count; ++i)
+                        out[n + i] = m_start_value + delta * F(m_frame + i - m_start_frame);
+                m_value = m_start_value + delta * F(m_frame + count - m_start_frame);
+                constant &= delta == F(0);
+            }
+
+            m_frame += count;
+            n += count;
+        }
+
+        return constant;
+    }
+
+    // Move to a new position on the owning stream’s timeline. Seeking
+    // forward applies the events in between; seeking backward keeps the
+    // current value, since events that were already applied are gone.
+    void seek(size_t frame)
+    {
+        if (frame >= m_frame)
+            render(nullptr, frame - m_frame);
+        else
+        {
+            m_frame = m_start_frame = frame;
+            m_start_value = m_value;
+        }
+    }
+
+private:
+    struct event
+    {
+        enum class type : uint8_t { set, linear, exponential };
+
+        type kind;
+        F value;
+        size_t frame;
+    };
+
+    void schedule(typename event::type kind, F value, size_t frame)
+    {
+        // Keep events sorted; events at the same frame stay in order
+        auto it = std::upper_bound(m_events.begin(), m_events.end(), frame,
+                                   [](size_t f, event const &e) { return f < e.frame; });
+        m_events.insert(it, event{ kind, value, frame });
+    }
+
+    std::vector<event> m_events;
+    F m_value;
+    size_t m_frame = 0;
+
+    // Start of the current segment, used by ramps
+    F m_start_value;
+    size_t m_start_frame = 0;
+};
+
+// A stream with an automated gain
+template<typename T>
+class gain : public stream<T>
+{
+public:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    gain(std::shared_ptr<stream<T>> s, F value = F(1))
+      : stream<T>(s->channels(), s->frequency()),
+        m_in(s),
+        m_gain(value)
+    {}
+
+    inline param<F> &amount() { return m_gain; }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const channels = this->channels();
+        size_t const samples = frames * channels;
+        size_t const ret = m_in->get(buf, frames);
+
+        if (m_ctrl.size() < frames)
+            m_ctrl.resize(frames);
+        F *data = nullptr;
+        if constexpr (std::is_same_v<T, F>)
+            data = buf;
+        else
+        {
+            // Integer samples are processed in floating point
+            if (m_tmp.size() < samples)
+                m_tmp.resize(samples);
+            data = m_tmp.data();
+            sample::convert_n(buf, data, samples);
+        }
+
+        if (m_gain.render(m_ctrl.data(), frames))
+        {
+            F const g = m_gain.value();
+            if (g == F(1))
+                return ret;
+            for (size_t i = 0; i < samples; ++i)
+                data[i] *= g;
+        }
+        else
+        {
+            for (size_t f = 0; f < frames; ++f)
+                for (size_t ch = 0; ch < channels; ++ch)
+                    data[f * channels + ch] *= m_ctrl[f];
+        }
+
+        if constexpr (!std::is_same_v<T, F>)
+            sample::convert_n(data, buf, samples);
+        return ret;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_in->size();
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_in->pos();
+    }
+
+    virtual bool seek(size_t pos) override
+    {
+        if (!m_in->seek(pos))
+            return false;
+        m_gain.seek(pos);
+        return true;
+    }
+
+protected:
+    std::shared_ptr<stream<T>> m_in;
+    param<F> m_gain;
+    std::vector<F> m_ctrl, m_tmp;
+};
+
+// Constant-power panning of a stereo stream. The position goes from −1
+// (left) to 1 (right); both channels are left untouched at the centre.
+template<typename T>
+class pan : public stream<T>
+{
+public:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    pan(std::shared_ptr<stream<T>> s, F value = F(0))
+      : stream<T>(2, s->frequency()),
+        m_in(s),
+        m_pan(value)
+    {
+        assert(s->channels() == 2);
+    }
+
+    inline param<F> &position() { return m_pan; }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const ret = m_in->get(buf, frames);
+
+        if (m_ctrl.size() < frames)
+            m_ctrl.resize(frames);
+        F *data = nullptr;
+        if constexpr (std::is_same_v<T, F>)
+            data = buf;
+        else
+        {
+            // Integer samples are processed in floating point
+            if (m_tmp.size() < 2 * frames)
+                m_tmp.resize(2 * frames);
+            data = m_tmp.data();
+            sample::convert_n(buf, data, 2 * frames);
+        }
+
+        if (m_pan.render(m_ctrl.data(), frames))
+        {
+            F l, r;
+            gains(m_pan.value(), l, r);
+            if (l == F(1) && r == F(1))
+                return ret;
+            for (size_t f = 0; f < frames; ++f)
+            {
+                data[2 * f] *= l;
+                data[2 * f + 1] *= r;
+            }
+        }
+        else
+        {
+            for (size_t f = 0; f < frames; ++f)
+            {
+                F l, r;
+                gains(m_ctrl[f], l, r);
+                data[2 * f] *= l;
+                data[2 * f + 1] *= r;
+            }
+        }
+
+        if constexpr (!std::is_same_v<T, F>)
+            sample::convert_n(data, buf, 2 * frames);
+        return ret;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_in->size();
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_in->pos();
+    }
+
+    virtual bool seek(size_t pos) override
+    {
+        if (!m_in->seek(pos))
+            return false;
+        m_pan.seek(pos);
+        return true;
+    }
+
+protected:
+    static void gains(F p, F &l, F &r)
+    {
+        if (p == F(0))
+        {
+            l = r = F(1);
+            return;
+        }
+        F const angle = (std::max(F(-1), std::min(F(1), p)) + F(1)) * F(F_PI_4);
+        l = F(std::cos(angle)) * F(F_SQRT_2);
+        r = F(std::sin(angle)) * F(F_SQRT_2);
+    }
+
+    std::shared_ptr<stream<T>> m_in;
+    param<F> m_pan;
+    std::vector<F> m_ctrl, m_tmp;
+};
+
+template<typename S, typename T = typename S::sample_type>
+static inline auto make_gain(std::shared_ptr<S> s, float value = 1.0f)
+{
+    return std::make_shared<gain<T>>(std::shared_ptr<stream<T>>(s), value);
+}
+
+template<typename S, typename T = typename S::sample_type>
+static inline auto make_pan(std::shared_ptr<S> s, float value = 0.0f)
+{
+    return std::make_shared<pan<T>>(std::shared_ptr<stream<T>>(s), value);
+}
+
+} // namespace lol::audio
@@ -0,0 +1,255 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Convolution
+// ———————————
+// FIR filtering with long impulse responses, e.g. convolution reverbs.
+//
+
+#include <algorithm> // std::min, std::fill, std::copy
+#include <cassert> // assert()
+#include <memory> // std::shared_ptr
+#include <optional> // std::optional
+#include <type_traits> // std::is_same_v
+#include <vector> // std::vector
+
+#include "../math/fft.h" // lol::fft
+#include "stream.h" // lol::audio::stream
+#include "sample.h" // lol::audio::sample
+
+namespace lol::audio
+{
+
+// Uniformly partitioned FFT convolution. The impulse response is split into
+// partitions of block_frames samples whose spectra are computed once; every
+// input block is transformed once, stored in a frequency-domain delay line,
+// and multiplied against all partitions before a single inverse transform.
+// The block tail is overlap-added into the next block.
+//
+// The impulse response is interleaved and has either one channel, which is
+// applied to every channel of the input, or as many channels as the input.
+// Input is pulled one block ahead, so there is no added latency.
+template<typename T>
+class convolver : public stream<T>
+{
+public:
+    convolver(std::shared_ptr<stream<T>> s, std::vector<float> const &ir, size_t ir_channels = 1,
+              size_t block_frames = 512)
+      : stream<T>(s->channels(), s->frequency()),
+        m_in(s),
+        m_block(round_up(block_frames)),
+        m_fft(2 * m_block)
+    {
+        size_t const channels = this->channels();
+        size_t const bins = m_fft.bins();
+
+        assert(ir_channels == 1 || ir_channels == channels);
+        m_ir_channels = ir_channels == 1 ? 1 : channels;
+        m_ir_frames = ir.size() / std::max(ir_channels, size_t(1));
+        m_partitions = std::max((m_ir_frames + m_block - 1) / m_block, size_t(1));
+
+        // Precompute the spectra of the impulse response partitions
+        m_ir_re.resize(m_ir_channels * m_partitions * bins);
+        m_ir_im.resize(m_ir_channels * m_partitions * bins);
+        m_time.resize(2 * m_block);
+        for (size_t ch = 0; ch < m_ir_channels; ++ch)
+        for (size_t p = 0; p < m_partitions; ++p)
+        {
+            std::fill(m_time.begin(), m_time.end(), F(0));
+            for (size_t n = 0; n < m_block && p * m_block + n < m_ir_frames; ++n)
+                m_time[n] = F(ir[(p * m_block + n) * ir_channels + ch]);
+            size_t const offset = (ch * m_partitions + p) * bins;
+            m_fft.forward(m_time.data(), m_ir_re.data() + offset, m_ir_im.data() + offset);
+        }
+
+        m_fdl_re.resize(channels * m_partitions * bins);
+        m_fdl_im.resize(channels * m_partitions * bins);
+        m_acc_re.resize(bins);
+        m_acc_im.resize(bins);
+        m_overlap.resize(channels * m_block);
+        m_in_buf.resize(channels * m_block);
+        m_out.resize(channels * m_block);
+        if constexpr (!std::is_same_v<T, F>)
+            m_in_tmp.resize(channels * m_block);
+        reset();
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const channels = this->channels();
+
+        for (size_t done = 0; done < frames; )
+        {
+            if (m_out_pos == m_block)
+                process();
+
+            size_t const count = std::min(frames - done, m_block - m_out_pos);
+            sample::convert_n(m_out.data() + m_out_pos * channels, buf + done * channels, count * channels);
+            m_out_pos += count;
+            done += count;
+        }
+
+        m_pos += frames;
+        return frames;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_in->size();
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_pos;
+    }
+
+    // Seek the input far enough back to rebuild the convolution state, and
+    // discard the frames before the new position.
+    virtual bool seek(size_t pos) override
+    {
+        size_t const priming = std::min(pos, m_ir_frames ? m_ir_frames - 1 : 0);
+        if (!m_in->seek(pos - priming))
+            return false;
+
+        reset();
+        m_pos = pos - priming;
+
+        std::vector<T> tmp(std::min(priming, m_block) * this->channels());
+        for (size_t left = priming; left; )
+        {
+            size_t const count = std::min(left, m_block);
+            get(tmp.data(), count);
+            left -= count;
+        }
+        return true;
+    }
+
+    // Length of the impulse response, in frames
+    inline size_t ir_frames() const { return m_ir_frames; }
+
+    // Partition size, in frames
+    inline size_t block_frames() const { return m_block; }
+
+protected:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    static size_t round_up(size_t n)
+    {
+        size_t ret = 4;
+        while (ret < n)
+            ret *= 2;
+        return ret;
+    }
+
+    void reset()
+    {
+        std::fill(m_fdl_re.begin(), m_fdl_re.end(), F(0));
+        std::fill(m_fdl_im.begin(), m_fdl_im.end(), F(0));
+        std::fill(m_overlap.begin(), m_overlap.end(), F(0));
+        m_fdl_pos = 0;
+        m_out_pos = m_block;
+    }
+
+    // Pull one block of input and render one block of output
+    void process()
+    {
+        size_t const channels = this->channels();
+        size_t const bins = m_fft.bins();
+
+        F *in = nullptr;
+        if constexpr (std::is_same_v<T, F>)
+        {
+            m_in->get(m_in_buf.data(), m_block);
+            in = m_in_buf.data();
+        }
+        else
+        {
+            m_in->get(m_in_buf.data(), m_block);
+            sample::convert_n(m_in_buf.data(), m_in_tmp.data(), m_block * channels);
+            in = m_in_tmp.data();
+        }
+
+        for (size_t ch = 0; ch < channels; ++ch)
+        {
+            // Transform the zero-padded input block into the delay line
+            for (size_t n = 0; n < m_block; ++n)
+                m_time[n] = in[n * channels + ch];
+            std::fill(m_time.begin() + m_block, m_time.end(), F(0));
+
+            F *fdl_re = m_fdl_re.data() + ch * m_partitions * bins;
+            F *fdl_im = m_fdl_im.data() + ch * m_partitions * bins;
+            m_fft.forward(m_time.data(), fdl_re + m_fdl_pos * bins, fdl_im + m_fdl_pos * bins);
+
+            // Multiply-accumulate block k − p with partition p
+            F const *ir_re = m_ir_re.data() + (m_ir_channels == 1 ? 0 : ch) * m_partitions * bins;
+            F const *ir_im = m_ir_im.data() + (m_ir_channels == 1 ? 0 : ch) * m_partitions * bins;
+            F *acc_re = m_acc_re.data(), *acc_im = m_acc_im.data();
+            std::fill(acc_re, acc_re + bins, F(0));
+            std::fill(acc_im, acc_im + bins, F(0));
+            for (size_t p = 0; p < m_partitions; ++p)
+            {
+                size_t const slot = (m_fdl_pos + m_partitions - p) % m_partitions;
+                F const *xr = fdl_re + slot * bins, *xi = fdl_im + slot * bins;
+                F const *hr = ir_re + p * bins, *hi = ir_im + p * bins;
+                for (size_t k = 0; k < bins; ++k)
+                {
+                    acc_re[k] += xr[k] * hr[k] - xi[k] * hi[k];
+                    acc_im[k] += xr[k] * hi[k] + xi[k] * hr[k];
+                }
+            }
+
+            m_fft.inverse(acc_re, acc_im, m_time.data());
+
+            // Overlap-add the previous tail, and keep the new one
+            F *overlap = m_overlap.data() + ch * m_block;
+            for (size_t n = 0; n < m_block; ++n)
+            {
+                m_out[n * channels + ch] = m_time[n] + overlap[n];
+                overlap[n] = m_time[m_block + n];
+            }
+        }
+
+        m_fdl_pos = (m_fdl_pos + 1) % m_partitions;
+        m_out_pos = 0;
+    }
+
+    std::shared_ptr<stream<T>> m_in;
+
+    size_t m_block;
+    fft<F> m_fft;
+
+    size_t m_ir_channels = 1, m_ir_frames = 0, m_partitions = 1;
+    std::vector<F> m_ir_re, m_ir_im;
+
+    // Frequency-domain delay line, one ring of spectra per channel
+    std::vector<F> m_fdl_re, m_fdl_im;
+    size_t m_fdl_pos = 0;
+
+    std::vector<F> m_acc_re, m_acc_im, m_time, m_overlap;
+    std::vector<T> m_in_buf;
+    std::vector<F> m_in_tmp, m_out;
+    size_t m_out_pos = 0;
+    size_t m_pos = 0;
+};
+
+template<typename S, typename T = typename S::sample_type>
+static inline auto make_convolver(std::shared_ptr<S> s, std::vector<float> const &ir, size_t ir_channels = 1,
+                                  size_t block_frames = 512)
+{
+    return std::make_shared<convolver<T>>(std::shared_ptr<stream<T>>(s), ir, ir_channels, block_frames);
+}
+
+} // namespace lol::audio
@@ -0,0 +1,228 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Dynamics processing
+// ———————————————————
+// Limiting and soft clipping streams, typically used on a master bus.
+//
+
+#include <algorithm> // std::max, std::min, std::fill
+#include <cmath> // std::abs, std::exp
+#include <memory> // std::shared_ptr
+#include <optional> // std::optional
+#include <type_traits> // std::is_same_v
+#include <utility> // std::pair
+#include <vector> // std::vector
+
+#include "stream.h" // lol::audio::stream
+#include "sample.h" // lol::audio::sample
+
+namespace lol::audio
+{
+
+// A lookahead peak limiter: the input is delayed by the lookahead time so
+// that the gain can be reduced smoothly before a peak reaches the output.
+// The gain follows the minimum required gain over the lookahead window with
+// the given attack and release times; a final clamp guarantees that the
+// output never exceeds the threshold.
+template<typename T>
+class limiter : public stream<T>
+{
+public:
+    limiter(std::shared_ptr<stream<T>> s, float threshold = 1.0f, float lookahead = 0.005f,
+            float attack = 0.001f, float release = 0.1f)
+      : stream<T>(s->channels(), s->frequency()),
+        m_in(s),
+        m_threshold(threshold),
+        m_lookahead(size_t(lookahead * s->frequency())),
+        m_attack(coeff(attack, s->frequency())),
+        m_release(coeff(release, s->frequency()))
+    {
+        m_delay.resize(std::max(m_lookahead, size_t(1)) * this->channels(), F(0));
+        m_window.resize(m_lookahead + 1);
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const channels = this->channels();
+        size_t const samples = frames * channels;
+
+        F *data = nullptr;
+        if constexpr (std::is_same_v<T, F>)
+        {
+            m_in->get(buf, frames);
+            data = buf;
+        }
+        else
+        {
+            // Integer samples are processed in floating point
+            if (m_in_buf.size() < samples)
+                m_in_buf.resize(samples);
+            if (m_tmp.size() < samples)
+                m_tmp.resize(samples);
+            m_in->get(m_in_buf.data(), frames);
+            sample::convert_n(m_in_buf.data(), m_tmp.data(), samples);
+            data = m_tmp.data();
+        }
+
+        for (size_t f = 0; f < frames; ++f, ++m_index)
+        {
+            F *frame = data + f * channels;
+
+            // Gain needed for this frame to stay below the threshold
+            F peak(0);
+            for (size_t ch = 0; ch < channels; ++ch)
+                peak = std::max(peak, std::abs(frame[ch]));
+            F const target = peak > m_threshold ? m_threshold / peak : F(1);
+
+            // Sliding window minimum of the required gain over the frames
+            // that are currently in the delay line
+            size_t const window = m_window.size();
+            if (m_count && m_window[m_head].second + window <= m_index)
+            {
+                m_head = (m_head + 1) % window;
+                --m_count;
+            }
+            while (m_count && m_window[(m_head + m_count - 1) % window].first >= target)
+                --m_count;
+            m_window[(m_head + m_count++) % window] = { target, m_index };
+            F const wanted = m_window[m_head].first;
+
+            F const k = wanted < m_gain ? m_attack : m_release;
+            m_gain = wanted + (m_gain - wanted) * k;
+
+            // Output the delayed frame and store the new one
+            F *delayed = m_lookahead ? m_delay.data() + (m_index % m_lookahead) * channels : frame;
+            for (size_t ch = 0; ch < channels; ++ch)
+            {
+                F const x = delayed[ch];
+                if (m_lookahead)
+                    delayed[ch] = frame[ch];
+                frame[ch] = std::max(-m_threshold, std::min(m_threshold, x * m_gain));
+            }
+        }
+
+        if constexpr (!std::is_same_v<T, F>)
+            sample::convert_n(data, buf, samples);
+
+        return frames;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_in->size();
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_in->pos();
+    }
+
+    // Output frame n is input frame n − latency(), so seek the input that
+    // far back and prime the delay line; only the gain history is lost.
+    virtual bool seek(size_t pos) override
+    {
+        size_t const priming = std::min(pos, m_lookahead);
+        if (!m_in->seek(pos - priming))
+            return false;
+
+        std::fill(m_delay.begin(), m_delay.end(), F(0));
+        m_count = m_head = m_index = 0;
+        m_gain = F(1);
+
+        std::vector<T> tmp(priming * this->channels());
+        get(tmp.data(), priming);
+        return true;
+    }
+
+    // Latency introduced by the lookahead, in frames
+    inline size_t latency() const { return m_lookahead; }
+
+protected:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    static F coeff(float time, int frequency)
+    {
+        return time > 0.0f ? F(std::exp(-1.0 / (time * frequency))) : F(0);
+    }
+
+    std::shared_ptr<stream<T>> m_in;
+
+    F m_threshold;
+    size_t m_lookahead;
+    F m_attack, m_release;
+    F m_gain = F(1);
+
+    // Delay line, and monotonic queue of (gain, frame index) pairs
+    std::vector<F> m_delay;
+    std::vector<std::pair<F, size_t>> m_window;
+    size_t m_head = 0, m_count = 0;
+    size_t m_index = 0;
+
+    std::vector<T> m_in_buf;
+    std::vector<F> m_tmp;
+};
+
+// Soft clipping using sample::fast_tanh()
+template<typename T>
+class softclip : public stream<T>
+{
+public:
+    softclip(std::shared_ptr<stream<T>> s)
+      : stream<T>(s->channels(), s->frequency()),
+        m_in(s)
+    {}
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const ret = m_in->get(buf, frames);
+        sample::softclip_n(buf, buf, frames * this->channels());
+        return ret;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_in->size();
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_in->pos();
+    }
+
+    virtual bool seek(size_t pos) override
+    {
+        return m_in->seek(pos);
+    }
+
+protected:
+    std::shared_ptr<stream<T>> m_in;
+};
+
+template<typename S, typename T = typename S::sample_type>
+static inline auto make_limiter(std::shared_ptr<S> s, float threshold = 1.0f, float lookahead = 0.005f,
+                                float attack = 0.001f, float release = 0.1f)
+{
+    return std::make_shared<limiter<T>>(std::shared_ptr<stream<T>>(s), threshold, lookahead, attack, release);
+}
+
+template<typename S, typename T = typename S::sample_type>
+static inline auto make_softclip(std::shared_ptr<S> s)
+{
+    return std::make_shared<softclip<T>>(std::shared_ptr<stream<T>>(s));
+}
+
+} // namespace lol::audio
@@ -0,0 +1,234 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// The audio graph
+// ———————————————
+// A graph of audio processing nodes rendered block by block. Nodes are
+// sorted topologically and their output buffers are taken from a shared
+// pool, where a buffer is reused as soon as no later node needs its
+// contents, like registers in a register allocator.
+//
+
+#include <algorithm> // std::min, std::fill
+#include <cassert> // assert()
+#include <cstdint> // uint8_t
+#include <functional> // std::function
+#include <memory> // std::shared_ptr
+#include <utility> // std::pair, std::move
+#include <vector> // std::vector
+
+#include "stream.h" // lol::audio::stream
+
+namespace lol::audio
+{
+
+template<typename T>
+class graph : public stream<T>
+{
+public:
+    using node_id = size_t;
+
+    // A processing function receives pointers to the output of each of its
+    // inputs, and writes “frames” frames to its own output.
+    using process_fn = std::function<void(T const * const *inputs, size_t count, T *output, size_t frames)>;
+
+    graph(size_t channels, int frequency, size_t block_frames = 256)
+      : stream<T>(channels, frequency),
+        m_block_frames(block_frames)
+    {}
+
+    // Add a node with a processing function; its inputs are added using
+    // connect() and their order is preserved.
+    node_id add_node(process_fn fn)
+    {
+        m_nodes.emplace_back(std::move(fn));
+        m_compiled = false;
+        return m_nodes.size() - 1;
+    }
+
+    // Add a node that reads from an existing stream, which must have the
+    // same channel count as the graph
+    node_id add_stream(std::shared_ptr<stream<T>> s)
+    {
+        assert(s->channels() == this->channels());
+        return add_node([s](T const * const *, size_t, T *output, size_t frames)
+        {
+            s->get(output, frames);
+        });
+    }
+
+    // Add a node that mixes all its inputs
+    node_id add_mixer()
+    {
+        size_t const channels = this->channels();
+        return add_node([channels](T const * const *inputs, size_t count, T *output, size_t frames)
+        {
+            std::fill(output, output + frames * channels, T(0));
+            for (size_t n = 0; n < count; ++n)
+                sample::sadd_n(output, inputs[n], output, frames * channels);
+        });
+    }
+
+    void connect(node_id from, node_id to)
+    {
+        m_nodes[to].inputs.push_back(from);
+        m_compiled = false;
+    }
+
+    void set_output(node_id id)
+    {
+        m_output = id;
+        m_compiled = false;
+    }
+
+    // Sort the nodes and assign buffers; this is done automatically by get()
+    // but can be called beforehand to avoid allocating in a real-time thread.
+    // Returns false if the nodes that feed the output contain a cycle.
+    bool compile()
+    {
+        m_order.clear();
+        m_buffers.clear();
+        m_compiled = false;
+
+        if (m_output >= m_nodes.size())
+            return false;
+
+        // Depth-first post-order traversal from the output: every node is
+        // scheduled after its inputs, and unused nodes are ignored.
+        enum : uint8_t { unvisited, visiting, done };
+        std::vector<uint8_t> state(m_nodes.size(), unvisited);
+        std::vector<std::pair<node_id, size_t>> todo { { m_output, 0 } };
+        state[m_output] = visiting;
+        while (todo.size())
+        {
+            auto &[id, next] = todo.back();
+            if (next < m_nodes[id].inputs.size())
+            {
+                node_id input = m_nodes[id].inputs[next++];
+                if (state[input] == visiting)
+                    return false;
+                if (state[input] == unvisited)
+                {
+                    state[input] = visiting;
+                    todo.push_back({ input, 0 });
+                }
+                continue;
+            }
+            state[id] = done;
+            m_order.push_back(id);
+            todo.pop_back();
+        }
+
+        // Find the last step at which each node’s output is needed
+        std::vector<size_t> last_use(m_nodes.size(), 0);
+        for (size_t step = 0; step < m_order.size(); ++step)
+            for (node_id input : m_nodes[m_order[step]].inputs)
+                last_use[input] = step;
+
+        // Linear scan allocation: a node’s buffer is taken before its inputs
+        // are released, so that outputs never alias inputs. The output node
+        // renders directly into the caller’s buffer.
+        std::vector<size_t> slot(m_nodes.size(), 0), free_slots;
+        size_t slot_count = 0;
+        for (size_t step = 0; step < m_order.size(); ++step)
+        {
+            node_id id = m_order[step];
+            if (id != m_output)
+            {
+                if (free_slots.empty())
+                    free_slots.push_back(slot_count++);
+                slot[id] = free_slots.back();
+                free_slots.pop_back();
+            }
+
+            for (node_id input : m_nodes[id].inputs)
+                if (last_use[input] == step)
+                {
+                    free_slots.push_back(slot[input]);
+                    last_use[input] = size_t(-1); // release only once
+                }
+        }
+
+        m_buffers.resize(slot_count);
+        for (auto &b : m_buffers)
+            b.resize(m_block_frames * this->channels());
+
+        // Precompute input pointers for every node
+        for (node_id id : m_order)
+        {
+            auto &n = m_nodes[id];
+            n.output = id == m_output ? nullptr : m_buffers[slot[id]].data();
+            n.input_ptrs.clear();
+            for (node_id input : n.inputs)
+                n.input_ptrs.push_back(m_buffers[slot[input]].data());
+        }
+
+        m_compiled = true;
+        return true;
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const channels = this->channels();
+
+        if (!m_compiled && !compile())
+        {
+            std::fill(buf, buf + frames * channels, T(0));
+            return frames;
+        }
+
+        for (size_t done = 0; done < frames; )
+        {
+            size_t const count = std::min(m_block_frames, frames - done);
+
+            for (node_id id : m_order)
+            {
+                auto &n = m_nodes[id];
+                T *output = n.output ? n.output : buf + done * channels;
+                n.fn(n.input_ptrs.data(), n.input_ptrs.size(), output, count);
+            }
+
+            done += count;
+        }
+
+        return frames;
+    }
+
+    // Number of intermediate buffers used by the compiled graph
+    inline size_t buffer_count() const { return m_buffers.size(); }
+
+protected:
+    struct node
+    {
+        explicit node(process_fn f) : fn(std::move(f)) {}
+
+        process_fn fn;
+        std::vector<node_id> inputs;
+
+        // Computed by compile()
+        std::vector<T const *> input_ptrs;
+        T *output = nullptr;
+    };
+
+    size_t m_block_frames;
+    node_id m_output = node_id(-1);
+    bool m_compiled = false;
+
+    std::vector<node> m_nodes;
+    std::vector<node_id> m_order;
+    std::vector<std::vector<T>> m_buffers;
+};
+
+} // namespace lol::audio
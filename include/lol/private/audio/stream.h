@@ -18,149 +18,30 @@
 // Stream, mix, and apply audio effects.
 //
 
-#include <cmath> // std::floor
-#include <functional> // std::function
+#include <algorithm> // std::fill, std::min, std::copy, std::remove_if
+#include <atomic> // std::atomic
+#include <cassert> // assert()
+#include <chrono> // std::chrono::steady_clock
+#include <condition_variable> // std::condition_variable
+#include <cstdint> // uint32_t
+#include <cmath> // std::floor, std::sqrt
+#include <functional> // std::function, std::hash, std::equal_to
 #include <limits> // std::numeric_limits
-#include <memory> // std::shared_ptr
+#include <memory> // std::shared_ptr, std::allocator_traits
+#include <mutex> // std::mutex
+#include <numeric> // std::gcd
 #include <optional> // std::optional
 #include <type_traits> // std::is_same_v
 #include <unordered_set> // std::unordered_set
+#include <vector> // std::vector
 
 #include "../math/interp.h" // lol::interp::lanczos
+#include "../sys/threading.h" // lol::thread_pool
+#include "sample.h" // lol::audio::sample
 
 namespace lol::audio
 {
 
-class sample
-{
-public:
-    // Convert samples between different types (float, int16_t, uint8_t, …)
-    template<typename FROM, typename TO>
-    static inline TO convert(FROM x)
-    {
-        constexpr auto from_fp = std::is_floating_point_v<FROM>;
-        constexpr auto to_fp = std::is_floating_point_v<TO>;
-
-        if constexpr (std::is_same_v<FROM, TO> || (from_fp && to_fp))
-        {
-            // If types are the same, or both floating point, no conversion is needed
-            return TO(x);
-        }
-        else if constexpr (from_fp)
-        {
-            // From floating point to integer:
-            //  - change range from -1…1 to 0…1
-            //  - multiply by the size of the integer range
-            //  - add min, round down, and clamp to min…max
-            FROM constexpr min(std::numeric_limits<TO>::min());
-            FROM constexpr max(std::numeric_limits<TO>::max());
-            x = (max - min + 1) / 2 * (x + 1);
-            return TO(std::max(min, std::min(max, std::floor(x + min))));
-        }
-        else if constexpr (to_fp)
-        {
-            // From integer to floating point:
-            //  - compute (x - min) / (max - min)
-            //  - change range from 0…1 to -1…1
-            TO constexpr min(std::numeric_limits<FROM>::min());
-            TO constexpr max(std::numeric_limits<FROM>::max());
-            return 2 / (max - min) * (TO(x) - min) - 1;
-        }
-        else
-        {
-            // When converting between integer types, we first convert to an unsigned
-            // type of same size as source (e.g. int16_t → uint16_t) to ensure that all
-            // operations will happen modulo n (not guaranteed with signed types).
-            // The next step is to shift right (drop bits) or promote left (multiply by
-            // a magic constant such as 0x1010101 or 0x10001). This happens using the
-            // UBIG type, which is an unsigned integer type at least as large as FROM
-            // and TO.
-            // Finally, we convert back to signed (e.g. uint16_t → int16_t) if necessary.
-            using UFROM = std::make_unsigned_t<FROM>;
-            using UTO = std::make_unsigned_t<TO>;
-            using UBIG = std::conditional_t<(sizeof(FROM) > sizeof(TO)), UFROM, UTO>;
-
-            UBIG constexpr mul = std::numeric_limits<UBIG>::max() / std::numeric_limits<UFROM>::max();
-            UBIG constexpr div = UBIG(1) << 8 * (sizeof(UBIG) - sizeof(UTO));
-            auto tmp = UFROM(UFROM(x) - UFROM(std::numeric_limits<FROM>::min())) * mul / div;
-
-            return TO(tmp + UTO(std::numeric_limits<TO>::min()));
-        }
-    }
-
-    // Saturated addition for samples
-    template<typename T>
-    static inline T sadd(T x, T y)
-    {
-        if constexpr (std::is_floating_point_v<T>)
-        {
-            // No saturation for floating point types
-            return x + y;
-        }
-        else if constexpr (sizeof(T) <= 4)
-        {
-            // For integer types up to 32-bit, do the computation with a larger type
-            using BIG = std::conditional_t<sizeof(T) == 1, int16_t,
-                        std::conditional_t<sizeof(T) == 2, int32_t,
-                        std::conditional_t<sizeof(T) == 4, int64_t, void>>>;
-            BIG constexpr min = std::numeric_limits<T>::min();
-            BIG constexpr max = std::numeric_limits<T>::max();
-            BIG constexpr zero = (min + max + 1) >> 1;
-
-            return T(std::max(min, std::min(max, BIG(BIG(x) + BIG(y) - zero))));
-        }
-        else if constexpr (std::is_unsigned_v<T>)
-        {
-            // Unsigned saturated add for 64-bit and larger: clamp according to overflow
-            T constexpr zero = T(1) << 8 * sizeof(T) - 1;
-            T constexpr minus_one = zero - T(1);
-            T ret = x + y;
-            return ret >= x ? std::max(zero, ret) - zero : std::min(minus_one, ret) + zero;
-        }
-        else
-        {
-            // Signed saturated add for 64-bit and larger: if signs differ, no overflow
-            // occurred, just return the sum of the arguments; otherwise, clamp according
-            // to the arguments sign.
-            using U = std::make_unsigned_t<T>;
-            U constexpr umax = U(std::numeric_limits<T>::max());
-            U constexpr umin = U(std::numeric_limits<T>::min());
-            U ret = U(x) + U(y);
-
-            return T(x ^ y) < 0 ? T(ret) : x >= 0 ? T(std::min(ret, umax)) : T(std::max(ret, umin));
-        }
-    }
-
-    // Clipping for samples
-    template<typename T>
-    static inline T clip(T x)
-    {
-        if constexpr (std::is_floating_point_v<T>)
-        {
-            return std::min(T(1), std::max(T(-1), x));
-        }
-        else
-        {
-            // Clipping is only relevant for floating point types
-            return x;
-        }
-    }
-
-    template<typename T>
-    static inline T softclip(T x)
-    {
-        if constexpr (std::is_floating_point_v<T>)
-        {
-            return std::tanh(x);
-        }
-        else
-        {
-            // Clipping is only relevant for floating point types
-            return x;
-        }
-    }
-};
-
 template<typename T>
 class stream
 {
@@ -211,7 +92,95 @@ protected:
     std::function<size_t(T*, size_t)> m_get;
 };
 
+// A stream that is fed by another thread: a single producer thread calls
+// write() while a single consumer (usually the audio callback) calls get().
+// Neither side ever blocks or allocates. Frames that do not fit are dropped,
+// and missing frames are replaced with silence.
 template<typename T>
+class ring_stream : public stream<T>
+{
+public:
+    ring_stream(size_t channels, int frequency, size_t capacity)
+      : stream<T>(channels, frequency)
+    {
+        // Round the capacity up to a power of two so that we can mask indices
+        while (m_capacity < capacity)
+            m_capacity *= 2;
+        m_data.resize(m_capacity * channels);
+    }
+
+    // Producer side: append up to “frames” frames and return how many
+    // were actually written.
+    size_t write(T const *buf, size_t frames)
+    {
+        size_t const w = m_write.load(std::memory_order_relaxed);
+        size_t const r = m_read.load(std::memory_order_acquire);
+        size_t const count = std::min(frames, m_capacity - (w - r));
+
+        size_t const offset = w & (m_capacity - 1);
+        size_t const first = std::min(count, m_capacity - offset);
+        size_t const channels = this->channels();
+        std::copy(buf, buf + first * channels, m_data.data() + offset * channels);
+        std::copy(buf + first * channels, buf + count * channels, m_data.data());
+
+        m_write.store(w + count, std::memory_order_release);
+
+        if (count < frames)
+            m_overruns.fetch_add(frames - count, std::memory_order_relaxed);
+        return count;
+    }
+
+    // Consumer side
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const r = m_read.load(std::memory_order_relaxed);
+        size_t const w = m_write.load(std::memory_order_acquire);
+        size_t const count = std::min(frames, w - r);
+
+        size_t const offset = r & (m_capacity - 1);
+        size_t const first = std::min(count, m_capacity - offset);
+        size_t const channels = this->channels();
+        T const *src = m_data.data();
+        std::copy(src + offset * channels, src + (offset + first) * channels, buf);
+        std::copy(src, src + (count - first) * channels, buf + first * channels);
+
+        m_read.store(r + count, std::memory_order_release);
+
+        if (count < frames)
+        {
+            std::fill(buf + count * channels, buf + frames * channels, T(0));
+            m_underruns.fetch_add(frames - count, std::memory_order_relaxed);
+        }
+        return frames;
+    }
+
+    // Number of frames ready to be read
+    size_t available() const
+    {
+        return m_write.load(std::memory_order_acquire) - m_read.load(std::memory_order_acquire);
+    }
+
+    inline size_t capacity() const { return m_capacity; }
+
+    // Number of frames that were replaced with silence, or dropped
+    inline size_t underruns() const { return m_underruns.load(std::memory_order_relaxed); }
+    inline size_t overruns() const { return m_overruns.load(std::memory_order_relaxed); }
+
+protected:
+    size_t m_capacity = 1;
+    std::vector<T> m_data;
+
+    // Keep data written by the producer and by the consumer in separate
+    // cache lines to avoid false sharing.
+    alignas(64) std::atomic<size_t> m_write = 0;
+    std::atomic<size_t> m_overruns = 0;
+
+    alignas(64) std::atomic<size_t> m_read = 0;
+    std::atomic<size_t> m_underruns = 0;
+};
+
+// Sum of several input streams. Internal buffers are allocated with A.
+template<typename T, typename A = std::allocator<T>>
 class mixer : public stream<T>
 {
 public:
@@ -221,7 +190,7 @@ public:
 
     void add(std::shared_ptr<stream<T>> s)
     {
-        // FIXME: check the channel count!
+        assert(s->channels() == this->channels());
         m_streams.insert(s);
     }
 
@@ -230,32 +199,440 @@ public:
         m_streams.erase(s);
     }
 
+    // Ensure that blocks of up to this many frames can be mixed without
+    // allocating memory; call this before starting a real-time thread.
+    void reserve(size_t frames)
+    {
+        size_t const samples = frames * this->channels();
+        if (m_scratch.size() < samples)
+            m_scratch.resize(samples);
+    }
+
     virtual size_t get(T *buf, size_t frames) override
     {
-        std::vector<std::vector<T>> buffers;
         size_t const samples = frames * this->channels();
 
-        for (auto s : m_streams)
+        // The scratch buffer only grows when a larger block than ever before
+        // is requested, so the steady-state path never allocates.
+        reserve(frames);
+
+        std::fill(buf, buf + samples, T(0));
+
+        // Only mix what each input produced, since the scratch buffer still
+        // holds the previous input’s samples past that point.
+        for (auto const &s : m_streams)
+        {
+            size_t const count = s->get(m_scratch.data(), frames);
+            sample::sadd_n(buf, m_scratch.data(), buf, std::min(count, frames) * this->channels());
+        }
+
+        m_pos += frames;
+        return frames;
+    }
+
+    // The size of the mix is the size of its longest input, and is unknown
+    // if any input has an unknown size.
+    virtual std::optional<size_t> size() const override
+    {
+        size_t ret = 0;
+        for (auto const &s : m_streams)
+        {
+            auto size = s->size();
+            if (!size)
+                return std::nullopt;
+            ret = std::max(ret, *size);
+        }
+        return ret;
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_pos;
+    }
+
+    // Seek all inputs; those that are shorter than the new position are
+    // moved to their end.
+    virtual bool seek(size_t pos) override
+    {
+        bool ret = true;
+        for (auto const &s : m_streams)
+        {
+            auto size = s->size();
+            ret &= s->seek(size ? std::min(pos, *size) : pos);
+        }
+        m_pos = pos;
+        return ret;
+    }
+
+protected:
+    template<typename U> using alloc = typename std::allocator_traits<A>::template rebind_alloc<U>;
+
+    std::unordered_set<std::shared_ptr<stream<T>>,
+                       std::hash<std::shared_ptr<stream<T>>>,
+                       std::equal_to<std::shared_ptr<stream<T>>>,
+                       alloc<std::shared_ptr<stream<T>>>> m_streams;
+
+    std::vector<T, A> m_scratch;
+
+    size_t m_pos = 0;
+};
+
+// A mixer that renders its input streams in parallel as jobs on a thread
+// pool, each into its own buffer. The results are summed in the order the
+// streams were added, so the output does not depend on scheduling. Streams
+// that are not ready when the deadline (a fraction of the block duration)
+// expires are dropped from that block instead of stalling the caller; a
+// stream is never rendered by two threads at the same time. The pool must
+// outlive the mixer.
+template<typename T>
+class parallel_mixer : public stream<T>
+{
+public:
+    parallel_mixer(size_t channels, int frequency, float deadline = 0.75f,
+                   thread_pool &pool = thread_pool::global())
+      : stream<T>(channels, frequency),
+        m_deadline(deadline),
+        m_pool(pool)
+    {}
+
+    // Late jobs still use the mixer, so wait for them
+    ~parallel_mixer()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [&]{ return m_running == 0; });
+    }
+
+    // Add an input stream; adding a stream twice has no effect
+    void add(std::shared_ptr<stream<T>> s)
+    {
+        assert(s->channels() == this->channels());
+        for (auto const &v : m_voices)
+            if (v->source == s)
+                return;
+
+        // A stream that was removed while a job was still rendering it gets
+        // its voice back, so that it is never rendered by two jobs at once
+        for (auto it = m_retired.begin(); it != m_retired.end(); ++it)
+        {
+            if ((*it)->source != s)
+                continue;
+            m_voices.push_back(std::move(*it));
+            m_retired.erase(it);
+            m_pending.reserve(m_voices.size());
+            return;
+        }
+
+        auto v = std::make_unique<voice>();
+        v->source = s;
+        v->buffer.resize(m_max_frames * this->channels());
+        m_voices.push_back(std::move(v));
+        m_pending.reserve(m_voices.size());
+    }
+
+    void remove(std::shared_ptr<stream<T>> s)
+    {
+        for (auto it = m_voices.begin(); it != m_voices.end(); ++it)
         {
-            buffers.push_back(std::vector<T>(samples));
-            s->get(buffers.back().data(), frames);
+            if ((*it)->source != s)
+                continue;
+
+            // A job may still be rendering this stream after the last
+            // deadline; keep it around until it is done.
+            if ((*it)->busy.load(std::memory_order_acquire))
+                m_retired.push_back(std::move(*it));
+            m_voices.erase(it);
+            return;
         }
+    }
+
+    // Ensure that the voice buffers can hold blocks of up to this many
+    // frames; call this before starting a real-time thread.
+    void reserve(size_t frames)
+    {
+        if (frames <= m_max_frames)
+            return;
+
+        m_max_frames = frames;
+        for (auto &v : m_voices)
+            if (!v->busy.load(std::memory_order_acquire))
+                v->buffer.resize(frames * this->channels());
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const samples = frames * this->channels();
+        auto const start = std::chrono::steady_clock::now();
+
+        reserve(frames);
 
-        for (size_t n = 0; n < samples; ++n)
+        // Pick all streams that are not still busy from a previous block
+        m_pending.clear();
+        for (auto &v : m_voices)
         {
-            T x = T(0);
+            if (v->busy.load(std::memory_order_acquire))
+            {
+                ++m_dropped;
+                continue;
+            }
 
-            for (auto const &b : buffers)
-                x = sample::sadd(x, b[n]);
+            if (v->buffer.size() < samples)
+                v->buffer.resize(samples);
+            v->frames = frames;
+            m_pending.push_back(v.get());
+        }
 
-            buf[n] = x;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_block;
+            m_left = m_pending.size();
+            m_running += m_pending.size();
+            for (auto v : m_pending)
+            {
+                v->block = m_block;
+                v->busy.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        // Jobs run inline when the pool has no workers
+        for (auto v : m_pending)
+            m_pool.run([this, v]{ render(v); });
+
+        // Sleep until all streams are rendered or time is up; we do not help
+        // the pool because a slow stream could then stall the caller.
+        auto const deadline = start + std::chrono::duration<float>(m_deadline * frames / this->frequency());
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait_until(lock, deadline, [&]{ return m_left == 0; });
+        }
+
+        // Sum the results in a deterministic order
+        std::fill(buf, buf + samples, T(0));
+        for (auto v : m_pending)
+        {
+            if (v->busy.load(std::memory_order_acquire))
+                ++m_dropped;
+            else
+                sample::sadd_n(buf, v->buffer.data(), buf, samples);
+        }
+
+        // Release retired streams that are no longer in use
+        m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(),
+                            [](auto const &v) { return !v->busy.load(std::memory_order_acquire); }),
+                        m_retired.end());
+
+        m_pos += frames;
+        return frames;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        size_t ret = 0;
+        for (auto const &v : m_voices)
+        {
+            auto size = v->source->size();
+            if (!size)
+                return std::nullopt;
+            ret = std::max(ret, *size);
+        }
+        return ret;
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_pos;
+    }
+
+    // Seek all inputs, after waiting for late jobs to finish with them;
+    // inputs that are shorter than the new position are moved to their end.
+    virtual bool seek(size_t pos) override
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&]{ return m_running == 0; });
+        }
+
+        bool ret = true;
+        for (auto const &v : m_voices)
+        {
+            auto size = v->source->size();
+            ret &= v->source->seek(size ? std::min(pos, *size) : pos);
+        }
+        m_pos = pos;
+        return ret;
+    }
+
+    // Number of times a stream was dropped from a block because it missed
+    // the deadline
+    inline size_t dropped() const { return m_dropped; }
+
+protected:
+    struct voice
+    {
+        std::shared_ptr<stream<T>> source;
+        std::vector<T> buffer;
+        size_t frames = 0;
+        size_t block = 0;
+        std::atomic<bool> busy = false;
+    };
+
+    void render(voice *v)
+    {
+        v->source->get(v->buffer.data(), v->frames);
+
+        // Notify while holding the lock, since the mixer may be destroyed
+        // as soon as it is released
+        std::lock_guard<std::mutex> lock(m_mutex);
+        v->busy.store(false, std::memory_order_release);
+        if (v->block == m_block)
+            --m_left;
+        --m_running;
+        m_cond.notify_all();
+    }
+
+    float m_deadline;
+    thread_pool &m_pool;
+    size_t m_max_frames = 0;
+    size_t m_dropped = 0;
+    size_t m_pos = 0;
+
+    std::vector<std::unique_ptr<voice>> m_voices, m_retired;
+    std::vector<voice *> m_pending;
+
+    // Current block, number of its streams still rendering, and number of
+    // render jobs still running, including late ones from previous blocks
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    size_t m_block = 0, m_left = 0, m_running = 0;
+};
+
+// A mixer with a fixed number of voice slots, for sounds that start and
+// stop very often. Slots live in contiguous storage with an intrusive free
+// list, and are referenced through handles that carry a generation counter,
+// so that a handle to a voice that was removed and whose slot was reused is
+// safely rejected. Adding, removing and mixing never allocate memory.
+// Voices whose stream returns fewer frames than requested are considered
+// finished and are removed automatically. Slots and buffers are allocated
+// with A.
+template<typename T, typename A = std::allocator<T>>
+class voice_pool : public stream<T>
+{
+public:
+    struct handle
+    {
+        uint32_t index = uint32_t(-1);
+        uint32_t generation = 0;
+
+        inline explicit operator bool() const { return index != uint32_t(-1); }
+    };
+
+    voice_pool(size_t channels, int frequency, size_t capacity)
+      : stream<T>(channels, frequency),
+        m_slots(capacity)
+    {
+        for (size_t n = 0; n < capacity; ++n)
+            m_slots[n].next = uint32_t(n + 1);
+        m_active.reserve(capacity);
+    }
+
+    // Start playing a stream; returns an invalid handle if the pool is full
+    // or if the stream does not have the same channel count as the pool
+    handle add(std::shared_ptr<stream<T>> s)
+    {
+        if (m_free >= m_slots.size() || s->channels() != this->channels())
+            return handle();
+
+        uint32_t const index = m_free;
+        auto &slot = m_slots[index];
+        m_free = slot.next;
+
+        slot.source = std::move(s);
+        slot.next = uint32_t(m_active.size());
+        m_active.push_back(index);
+        return handle { index, slot.generation };
+    }
+
+    bool remove(handle h)
+    {
+        if (!contains(h))
+            return false;
+        release(h.index);
+        return true;
+    }
+
+    inline bool contains(handle h) const
+    {
+        return h.index < m_slots.size() && m_slots[h.index].generation == h.generation
+                && m_slots[h.index].source;
+    }
+
+    // Number of voices currently playing
+    inline size_t count() const { return m_active.size(); }
+
+    inline size_t capacity() const { return m_slots.size(); }
+
+    // Ensure that blocks of up to this many frames can be mixed without
+    // allocating memory; call this before starting a real-time thread.
+    void reserve(size_t frames)
+    {
+        size_t const samples = frames * this->channels();
+        if (m_scratch.size() < samples)
+            m_scratch.resize(samples);
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const samples = frames * this->channels();
+
+        reserve(frames);
+        std::fill(buf, buf + samples, T(0));
+
+        // Iterate backwards so that finished voices can be released on the
+        // fly without skipping any voice.
+        for (size_t n = m_active.size(); n--; )
+        {
+            uint32_t const index = m_active[n];
+            size_t const count = m_slots[index].source->get(m_scratch.data(), frames);
+            sample::sadd_n(buf, m_scratch.data(), buf, std::min(count, frames) * this->channels());
+            if (count < frames)
+                release(index);
         }
 
         return frames;
     }
 
 protected:
-    std::unordered_set<std::shared_ptr<stream<T>>> m_streams;
+    struct slot
+    {
+        std::shared_ptr<stream<T>> source;
+        uint32_t generation = 0;
+
+        // Next free slot when free, position in m_active when in use
+        uint32_t next = 0;
+    };
+
+    void release(uint32_t index)
+    {
+        auto &slot = m_slots[index];
+
+        // Swap-remove from the dense list of active voices
+        uint32_t const last = m_active.back();
+        m_active[slot.next] = last;
+        m_slots[last].next = slot.next;
+        m_active.pop_back();
+
+        slot.source.reset();
+        ++slot.generation;
+        slot.next = m_free;
+        m_free = index;
+    }
+
+    template<typename U> using alloc = typename std::allocator_traits<A>::template rebind_alloc<U>;
+
+    std::vector<slot, alloc<slot>> m_slots;
+    std::vector<uint32_t, alloc<uint32_t>> m_active;
+    uint32_t m_free = 0;
+
+    std::vector<T, A> m_scratch;
 };
 
 template<typename T, typename T0>
@@ -274,10 +651,10 @@ public:
 
         size_t samples = frames * this->channels();
 
-        std::vector<T0> tmp(samples);
-        m_in->get(tmp.data(), frames);
-        for (size_t n = 0; n < samples; ++n)
-            buf[n] = sample::convert<T0, T>(tmp[n]);
+        if (m_scratch.size() < samples)
+            m_scratch.resize(samples);
+        m_in->get(m_scratch.data(), frames);
+        sample::convert_n(m_scratch.data(), buf, samples);
 
         return frames;
     }
@@ -299,40 +676,62 @@ public:
 
 protected:
     std::shared_ptr<stream<T0>> m_in;
+
+    std::vector<T0> m_scratch;
 };
 
+// Change the number of channels of a stream. Channels are assumed to follow
+// the usual WAVE order: L R for stereo, L R C LFE Ls Rs for 5.1, and
+// L R C LFE Lb Rb Ls Rs for 7.1. By default, the output never exceeds the
+// input range; when energy preservation is requested, each input channel
+// contributes the same power to the output as it had in the input.
 template<typename T>
 class mapper : public stream<T>
 {
 public:
-    mapper(std::shared_ptr<stream<T>> s, size_t channels)
+    mapper(std::shared_ptr<stream<T>> s, size_t channels, bool preserve_energy = false)
       : stream<T>(channels, s->frequency()),
-        m_in(s)
-    {}
+        m_in(s),
+        m_matrix(matrix(s->channels(), channels, preserve_energy))
+    {
+        size_t const in = s->channels();
+
+        // Common layouts get kernels with a fixed number of channels
+        m_kernel = in == 1 && channels == 2 ? &kernel<1, 2>
+                 : in == 2 && channels == 1 ? &kernel<2, 1>
+                 : in == 6 && channels == 2 ? &kernel<6, 2>
+                 : in == 8 && channels == 2 ? &kernel<8, 2>
+                 : in == 8 && channels == 6 ? &kernel<8, 6>
+                 : &kernel<0, 0>;
+    }
 
     virtual size_t get(T *buf, size_t frames) override
     {
-        if (this->channels() == m_in->channels())
-            return m_in->get(buf, frames);
+        size_t const in = m_in->channels();
+        size_t const out = this->channels();
 
-        std::vector<T> tmp(frames * m_in->channels());
-        m_in->get(tmp.data(), frames);
+        if (in == out)
+            return m_in->get(buf, frames);
 
-        // FIXME: we need to build a better matrix than this, also maybe the mapper
-        // constructor needs an option to preserve energy or not?
-        std::vector<T> matrix(m_in->channels() * this->channels(), T(1));
+        if (m_in_buf.size() < frames * in)
+            m_in_buf.resize(frames * in);
+        m_in->get(m_in_buf.data(), frames);
 
-        for (size_t f = 0; f < frames; ++f)
+        if constexpr (std::is_same_v<T, F>)
         {
-            for (size_t out_ch = 0; out_ch < this->channels(); ++out_ch)
-            {
-                T x(0);
-
-                for (size_t in_ch = 0; in_ch < m_in->channels(); ++in_ch)
-                    x = sample::sadd(x, tmp[f * m_in->channels() + in_ch] * matrix[out_ch * m_in->channels() + in_ch]);
-
-                buf[f * this->channels() + out_ch] = x;
-            }
+            m_kernel(m_in_buf.data(), buf, m_matrix.data(), frames, in, out);
+        }
+        else
+        {
+            // Integer samples are mixed in floating point
+            if (m_tmp_in.size() < frames * in)
+                m_tmp_in.resize(frames * in);
+            if (m_tmp_out.size() < frames * out)
+                m_tmp_out.resize(frames * out);
+
+            sample::convert_n(m_in_buf.data(), m_tmp_in.data(), frames * in);
+            m_kernel(m_tmp_in.data(), m_tmp_out.data(), m_matrix.data(), frames, in, out);
+            sample::convert_n(m_tmp_out.data(), buf, frames * out);
         }
 
         return frames;
@@ -353,65 +752,317 @@ public:
         return m_in->seek(pos);
     }
 
+    // Build the out×in row-major matrix used to map “in” channels to “out”
+    // channels.
+    static std::vector<float> matrix(size_t in, size_t out, bool preserve_energy = false)
+    {
+        std::vector<float> ret(in * out, 0.0f);
+        auto m = [&](size_t o, size_t i) -> float & { return ret[o * in + i]; };
+
+        float constexpr k = 0.70710678f; // −3 dB
+
+        if (in == out)
+        {
+            for (size_t ch = 0; ch < in; ++ch)
+                m(ch, ch) = 1.0f;
+        }
+        else if (in == 1)
+        {
+            // Mono to anything: the centre channel if there is one
+            for (size_t o = 0; o < out; ++o)
+                m(o, 0) = out >= 3 ? float(o == 2) : 1.0f;
+        }
+        else if (out == 1)
+        {
+            // Anything to mono: every channel except LFE
+            for (size_t i = 0; i < in; ++i)
+                m(0, i) = in >= 4 && i == 3 ? 0.0f : 1.0f;
+        }
+        else if (in == 6 && out == 2)
+        {
+            // ITU-R BS.775 downmix; LFE is dropped
+            m(0, 0) = m(1, 1) = 1.0f;
+            m(0, 2) = m(1, 2) = k;
+            m(0, 4) = m(1, 5) = k;
+        }
+        else if (in == 8 && out == 6)
+        {
+            // Merge the back and side surround channels
+            for (size_t ch = 0; ch < 6; ++ch)
+                m(ch, ch) = 1.0f;
+            m(4, 6) = m(5, 7) = 1.0f;
+        }
+        else if (in == 8 && out == 2)
+        {
+            m(0, 0) = m(1, 1) = 1.0f;
+            m(0, 2) = m(1, 2) = k;
+            m(0, 4) = m(1, 5) = m(0, 6) = m(1, 7) = k;
+        }
+        else
+        {
+            // Upmixes and unknown layouts: keep common channels, fold the
+            // extra input channels onto the available outputs
+            for (size_t i = 0; i < in; ++i)
+                m(i % out, i) = 1.0f;
+        }
+
+        if (preserve_energy)
+        {
+            // Give each input channel a unit L2 norm
+            for (size_t i = 0; i < in; ++i)
+            {
+                float sum = 0.0f;
+                for (size_t o = 0; o < out; ++o)
+                    sum += m(o, i) * m(o, i);
+                for (size_t o = 0; o < out && sum > 0.0f; ++o)
+                    m(o, i) /= std::sqrt(sum);
+            }
+        }
+        else
+        {
+            // Make sure no output channel can exceed the input range
+            for (size_t o = 0; o < out; ++o)
+            {
+                float sum = 0.0f;
+                for (size_t i = 0; i < in; ++i)
+                    sum += m(o, i);
+                for (size_t i = 0; i < in && sum > 1.0f; ++i)
+                    m(o, i) /= sum;
+            }
+        }
+
+        return ret;
+    }
+
 protected:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    // Apply the matrix to a block of frames; when IN and OUT are known at
+    // compile time the inner loops can be fully unrolled.
+    template<size_t IN, size_t OUT>
+    static void kernel(F const *src, F *dst, float const *matrix, size_t frames, size_t in, size_t out)
+    {
+        if constexpr (IN != 0)
+        {
+            in = IN;
+            out = OUT;
+        }
+
+        for (size_t f = 0; f < frames; ++f, src += in, dst += out)
+        {
+            for (size_t o = 0; o < out; ++o)
+            {
+                F x(0);
+                for (size_t i = 0; i < in; ++i)
+                    x += src[i] * F(matrix[o * in + i]);
+                dst[o] = x;
+            }
+        }
+    }
+
     std::shared_ptr<stream<T>> m_in;
+
+    std::vector<float> m_matrix;
+    void (*m_kernel)(F const *, F *, float const *, size_t, size_t, size_t);
+
+    std::vector<T> m_in_buf;
+    std::vector<F> m_tmp_in, m_tmp_out;
 };
 
+// Polyphase resampler: the ratio between the input and output rates is
+// reduced to a fraction M/L, and the Lanczos filter coefficients for each of
+// the L possible output phases are computed once at construction.
 template<typename T>
 class resampler : public stream<T>
 {
 public:
     resampler(std::shared_ptr<stream<T>> s, int frequency)
       : stream<T>(s->channels(), frequency),
-        m_in(s),
-        m_pos(0)
-    {}
-
-    virtual size_t get(T *buf, size_t frames) override
+        m_in(s)
     {
-        size_t const channels = this->channels();
         size_t const in_rate = m_in->frequency();
         size_t const out_rate = this->frequency();
+        size_t const g = std::gcd(in_rate, out_rate);
+
+        m_step = in_rate / g;
+        m_phase_count = out_rate / g;
+
+        // When decimating, the kernel is stretched by M/L so that its cutoff
+        // is the output Nyquist frequency, which needs that many more taps.
+        // Beyond max_taps the stretched kernel is truncated.
+        F const cutoff = std::min(F(1), F(m_phase_count) / F(m_step));
+        m_taps = std::min(max_taps, (size_t(std::ceil(F(taps) / cutoff)) + 1) / 2 * 2);
+
+        // Very unusual ratios would need huge tables; use the nearest phase
+        // from a finer grid in that case.
+        size_t const tables = std::min(m_phase_count, max_phases);
+        m_coeffs.resize(tables * m_taps);
+        for (size_t p = 0; p < tables; ++p)
+        {
+            F const alpha = F(p) / F(tables);
+            F *coeffs = &m_coeffs[p * m_taps];
+            F sum(0);
+
+            for (size_t k = 0; k < m_taps; ++k)
+            {
+                F const x = F(k) - F(m_taps / 2) - alpha;
+                sum += coeffs[k] = interp::lanczos<F, taps>::weight(x * cutoff);
+            }
+
+            // Normalise each phase so that the DC gain is exactly 1
+            for (size_t k = 0; k < m_taps; ++k)
+                coeffs[k] /= sum;
+        }
 
-        if (in_rate == out_rate)
+        m_ring.resize((ring_frames + m_taps) * this->channels());
+    }
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        if (m_step == m_phase_count)
             return m_in->get(buf, frames);
 
-        for (size_t n = 0; n < frames; ++n, m_pos += in_rate)
+        size_t const channels = this->channels();
+        size_t const tables = m_coeffs.size() / m_taps;
+
+        for (size_t n = 0; n < frames; ++n, buf += channels)
         {
-            // Fill internal buffer if we don’t have enough data
-            while (m_cache.size() / channels < m_pos / out_rate + m_lanczos.size())
+            // When decimating by a large factor, m_read may be ahead of
+            // m_write; fill() then skips the input frames in between.
+            while (m_write < m_read + m_taps)
+                fill();
+
+            size_t const p = tables == m_phase_count ? m_phase : m_phase * tables / m_phase_count;
+            F const *coeffs = &m_coeffs[p * m_taps];
+            T const *src = &m_ring[(m_read % ring_frames) * channels];
+
+            // Process all channels of a frame together; the ring buffer is
+            // mirrored so that the filter window is always contiguous.
+            F acc[max_channels];
+            for (size_t ch0 = 0; ch0 < channels; ch0 += max_channels)
             {
-                // Remove obsolete frames on the left
-                size_t todelete = std::min(m_pos / out_rate, m_cache.size() / channels);
-                std::vector<T>(m_cache.begin() + todelete * channels, m_cache.end()).swap(m_cache);
-                m_pos -= todelete * out_rate;
-
-                // Add new frames to the right
-                size_t offset = m_cache.size();
-                m_cache.resize(offset + frames * channels);
-                m_in->get(&m_cache[offset], frames);
-            }
+                size_t const count = std::min(max_channels, channels - ch0);
+                for (size_t ch = 0; ch < count; ++ch)
+                    acc[ch] = F(0);
+
+                for (size_t k = 0; k < m_taps; ++k)
+                    for (size_t ch = 0; ch < count; ++ch)
+                        acc[ch] += F(src[k * channels + ch0 + ch]) * coeffs[k];
 
-            size_t n0 = m_pos / out_rate;
-            float alpha = float(m_pos % out_rate) / out_rate;
+                for (size_t ch = 0; ch < count; ++ch)
+                    buf[ch0 + ch] = to_sample(acc[ch]);
+            }
 
-            for (size_t ch = 0; ch < channels; ++ch)
-                *buf++ = m_lanczos.get(&m_cache[n0 * channels + ch], channels, alpha);
+            m_phase += m_step;
+            m_read += m_phase / m_phase_count;
+            m_phase %= m_phase_count;
         }
 
+        m_pos += frames;
         return frames;
     }
 
-    // FIXME: size/pos/seek API
+    // Number of input frames by which the output lags behind the input
+    inline size_t delay() const
+    {
+        return m_step == m_phase_count ? 0 : m_taps / 2;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        if (auto in_size = m_in->size())
+            return (*in_size * m_phase_count + m_step - 1) / m_step;
+        return std::nullopt;
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        if (m_step == m_phase_count)
+            return m_in->pos();
+        return m_pos;
+    }
+
+    virtual bool seek(size_t pos) override
+    {
+        if (m_step == m_phase_count)
+            return m_in->seek(pos);
+
+        // Output frame n is computed from the filter window that starts at
+        // input frame n·M/L, so seeking the input there and refilling the
+        // window gives the same samples as continuous playback.
+        size_t const in_pos = pos * m_step / m_phase_count;
+        if (!m_in->seek(in_pos))
+            return false;
+
+        m_read = m_write = 0;
+        m_phase = pos * m_step % m_phase_count;
+        m_pos = pos;
+        return true;
+    }
 
 protected:
+    // Intermediate computations are done in floating point
+    using F = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+    static size_t constexpr taps = 16;
+    static size_t constexpr max_taps = 512;
+    static size_t constexpr max_phases = 1024;
+    static size_t constexpr max_channels = 8;
+    static size_t constexpr ring_frames = 1024;
+
+    static T to_sample(F x)
+    {
+        if constexpr (std::is_floating_point_v<T>)
+            return x;
+        else
+        {
+            F constexpr min(std::numeric_limits<T>::min());
+            F constexpr max(std::numeric_limits<T>::max());
+            return T(std::max(min, std::min(max, std::floor(x + F(0.5)))));
+        }
+    }
+
+    // Append as many input frames to the ring buffer as possible; frames
+    // before m_read are never filtered, but are read from the input anyway
+    void fill()
+    {
+        size_t const channels = this->channels();
+        size_t const offset = m_write % ring_frames;
+        size_t const used = m_write > m_read ? m_write - m_read : 0;
+        size_t const count = std::min(ring_frames - used, ring_frames - offset);
+
+        T *dst = &m_ring[offset * channels];
+        size_t const received = std::min(count, m_in->get(dst, count));
+
+        // Pad with silence if the input stream ran out of data
+        std::fill(dst + received * channels, dst + count * channels, T(0));
+
+        // Mirror the first frames after the end of the buffer
+        if (offset < m_taps)
+        {
+            size_t const mirror = std::min(count, m_taps - offset);
+            std::copy(dst, dst + mirror * channels, dst + ring_frames * channels);
+        }
+
+        m_write += count;
+    }
+
     std::shared_ptr<stream<T>> m_in;
 
-    interp::lanczos<T> m_lanczos;
+    // Reduced rate ratio: each output frame advances m_step/m_phase_count
+    // input frames. Each output frame is computed from m_taps input frames.
+    size_t m_step, m_phase_count;
+    size_t m_taps;
+    std::vector<F> m_coeffs;
 
-    std::vector<T> m_cache;
+    // Input frames in the [m_read, m_write) range are stored in the ring
+    std::vector<T> m_ring;
+    size_t m_read = 0, m_write = 0;
+    size_t m_phase = 0;
 
-    size_t m_pos;
+    // Position in output frames
+    size_t m_pos = 0;
 };
 
 template<typename T>
@@ -433,9 +1084,9 @@ static inline auto make_converter(std::shared_ptr<S0> s)
 }
 
 template<typename S, typename T = typename S::sample_type>
-static inline auto make_mapper(std::shared_ptr<S> s, size_t channels)
+static inline auto make_mapper(std::shared_ptr<S> s, size_t channels, bool preserve_energy = false)
 {
-    return std::make_shared<mapper<T>>(std::shared_ptr<stream<T>>(s), channels);
+    return std::make_shared<mapper<T>>(std::shared_ptr<stream<T>>(s), channels, preserve_energy);
 }
 
 template<typename S, typename T = typename S::sample_type>
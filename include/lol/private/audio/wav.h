@@ -0,0 +1,365 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// WAV file streams
+// ————————————————
+// Read PCM WAV files as audio streams, and render audio streams to WAV
+// files. Only little-endian hosts are supported.
+//
+
+#include <algorithm> // std::min, std::fill
+#include <cstdint> // uint8_t, int16_t…
+#include <cstring> // std::memcpy
+#include <fstream> // std::ofstream
+#include <iterator> // std::size
+#include <memory> // std::shared_ptr
+#include <optional> // std::optional
+#include <string> // std::string
+#include <vector> // std::vector
+
+#include "../sys/file.h" // lol::mapped_file
+#include "stream.h" // lol::audio::stream
+#include "sample.h" // lol::audio::sample
+
+namespace lol::audio
+{
+
+// WAV file format helpers
+class wav
+{
+public:
+    enum class format : uint8_t
+    {
+        none, u8, s16, s24, s32, f32, f64,
+    };
+
+    struct info
+    {
+        size_t channels = 0;
+        int frequency = 0;
+        format type = format::none;
+
+        // Location of the sample data in the file, and size in frames
+        size_t offset = 0;
+        size_t frames = 0;
+    };
+
+    // The on-disk format matching a sample type, if any
+    template<typename T>
+    static constexpr format format_of()
+    {
+        return std::is_same_v<T, uint8_t> ? format::u8
+             : std::is_same_v<T, int16_t> ? format::s16
+             : std::is_same_v<T, int32_t> ? format::s32
+             : std::is_same_v<T, float> ? format::f32
+             : std::is_same_v<T, double> ? format::f64
+             : format::none;
+    }
+
+    static size_t bytes(format f)
+    {
+        switch (f)
+        {
+            case format::u8: return 1;
+            case format::s16: return 2;
+            case format::s24: return 3;
+            case format::s32: case format::f32: return 4;
+            case format::f64: return 8;
+            default: return 0;
+        }
+    }
+
+    // Parse the RIFF structure of a WAV file in memory
+    static std::optional<info> parse(uint8_t const *data, size_t size)
+    {
+        if (size < 12 || std::memcmp(data, "RIFF", 4) || std::memcmp(data + 8, "WAVE", 4))
+            return std::nullopt;
+
+        info ret;
+        bool has_fmt = false;
+
+        for (size_t pos = 12; pos + 8 <= size; )
+        {
+            uint8_t const *chunk = data + pos;
+            size_t const chunk_size = get32(chunk + 4);
+            pos += 8;
+
+            if (!std::memcmp(chunk, "fmt ", 4) && chunk_size >= 16 && pos + 16 <= size)
+            {
+                uint16_t tag = get16(chunk + 8);
+                ret.channels = get16(chunk + 10);
+                ret.frequency = int(get32(chunk + 12));
+                uint16_t const bits = get16(chunk + 22);
+
+                // WAVE_FORMAT_EXTENSIBLE stores the actual tag in the sub-format GUID
+                if (tag == 0xfffe && chunk_size >= 40 && pos + 40 <= size)
+                    tag = get16(chunk + 32);
+
+                ret.type = tag == 1 && bits == 8 ? format::u8
+                         : tag == 1 && bits == 16 ? format::s16
+                         : tag == 1 && bits == 24 ? format::s24
+                         : tag == 1 && bits == 32 ? format::s32
+                         : tag == 3 && bits == 32 ? format::f32
+                         : tag == 3 && bits == 64 ? format::f64
+                         : format::none;
+                has_fmt = true;
+            }
+            else if (!std::memcmp(chunk, "data", 4) && has_fmt)
+            {
+                if (ret.type == format::none || ret.channels == 0)
+                    return std::nullopt;
+
+                // Truncated files are accepted; only complete frames are used
+                ret.offset = pos;
+                ret.frames = std::min(chunk_size, size - pos) / (ret.channels * bytes(ret.type));
+                return ret;
+            }
+
+            // Chunks are padded to an even size
+            pos += chunk_size + (chunk_size & 1);
+        }
+
+        return std::nullopt;
+    }
+
+private:
+    static inline uint16_t get16(uint8_t const *p)
+    {
+        return uint16_t(p[0] | p[1] << 8);
+    }
+
+    static inline uint32_t get32(uint8_t const *p)
+    {
+        return uint32_t(p[0] | p[1] << 8 | p[2] << 16) | uint32_t(p[3]) << 24;
+    }
+};
+
+// A stream reading from a memory-mapped WAV file. When the on-disk format
+// matches T, samples are copied straight from the mapping; otherwise they
+// are converted using sample::convert_n().
+template<typename T>
+class wav_stream : public stream<T>
+{
+public:
+    wav_stream(std::unique_ptr<mapped_file> file, wav::info const &info)
+      : stream<T>(info.channels, info.frequency),
+        m_file(std::move(file)),
+        m_info(info)
+    {}
+
+    virtual size_t get(T *buf, size_t frames) override
+    {
+        size_t const channels = this->channels();
+        size_t const count = std::min(frames, m_info.frames - m_pos);
+        size_t const samples = count * channels;
+        uint8_t const *src = m_file->data() + m_info.offset
+                           + m_pos * channels * wav::bytes(m_info.type);
+
+        switch (m_info.type)
+        {
+            case wav::format::u8: read<uint8_t>(src, buf, samples); break;
+            case wav::format::s16: read<int16_t>(src, buf, samples); break;
+            case wav::format::s24: read<int32_t>(src, buf, samples); break;
+            case wav::format::s32: read<int32_t>(src, buf, samples); break;
+            case wav::format::f32: read<float>(src, buf, samples); break;
+            case wav::format::f64: read<double>(src, buf, samples); break;
+            default: break;
+        }
+
+        // Pad with silence after the end of the file
+        std::fill(buf + samples, buf + frames * channels, T(0));
+
+        m_pos += count;
+        return count;
+    }
+
+    virtual std::optional<size_t> size() const override
+    {
+        return m_info.frames;
+    }
+
+    virtual std::optional<size_t> pos() const override
+    {
+        return m_pos;
+    }
+
+    virtual bool seek(size_t pos) override
+    {
+        if (pos > m_info.frames)
+            return false;
+        m_pos = pos;
+        return true;
+    }
+
+    // Direct access to the samples at the current position, if the file
+    // stores them as T; returns nullptr otherwise.
+    T const *data() const
+    {
+        if (m_info.type != wav::format_of<T>())
+            return nullptr;
+
+        uint8_t const *p = m_file->data() + m_info.offset + m_pos * this->frame_size();
+        return uintptr_t(p) % alignof(T) ? nullptr : (T const *)p;
+    }
+
+    inline wav::info const &info() const { return m_info; }
+
+protected:
+    template<typename D>
+    void read(uint8_t const *src, T *dst, size_t samples)
+    {
+        constexpr bool direct = wav::format_of<D>() == wav::format_of<T>() && std::is_same_v<D, T>;
+
+        if (m_info.type == wav::format::s24 || (!direct && uintptr_t(src) % alignof(D)))
+        {
+            // 24-bit samples, and misaligned data, go through a small
+            // staging buffer.
+            D tmp[256];
+            size_t const size = wav::bytes(m_info.type);
+            for (size_t done = 0; done < samples; )
+            {
+                size_t const count = std::min(samples - done, std::size(tmp));
+                if (m_info.type == wav::format::s24)
+                {
+                    for (size_t n = 0; n < count; ++n, src += 3)
+                        tmp[n] = D(uint32_t(src[0]) << 8 | uint32_t(src[1]) << 16 | uint32_t(src[2]) << 24);
+                }
+                else
+                {
+                    std::memcpy(tmp, src, count * size);
+                    src += count * size;
+                }
+                sample::convert_n(tmp, dst + done, count);
+                done += count;
+            }
+        }
+        else if constexpr (direct)
+            std::memcpy(dst, src, samples * sizeof(T));
+        else
+            sample::convert_n((D const *)src, dst, samples);
+    }
+
+    std::unique_ptr<mapped_file> m_file;
+    wav::info m_info;
+    size_t m_pos = 0;
+};
+
+// Write WAV files. Frames are written as they come, so arbitrarily long
+// renders only need a constant amount of memory; the header sizes are
+// updated by close(). Files are limited to 4 GiB by the format.
+template<typename T>
+class wav_writer
+{
+    static_assert(wav::format_of<T>() != wav::format::none, "unsupported WAV sample type");
+
+public:
+    wav_writer(std::string const &path, size_t channels, int frequency)
+      : m_file(path, std::ios::binary),
+        m_channels(channels)
+    {
+        uint16_t const tag = std::is_floating_point_v<T> ? 3 : 1;
+        uint32_t const frame_size = uint32_t(channels * sizeof(T));
+
+        m_file.write("RIFF\0\0\0\0WAVEfmt ", 16);
+        put32(16);
+        put16(tag);
+        put16(uint16_t(channels));
+        put32(uint32_t(frequency));
+        put32(uint32_t(frequency) * frame_size);
+        put16(uint16_t(frame_size));
+        put16(uint16_t(8 * sizeof(T)));
+        m_file.write("data\0\0\0\0", 8);
+    }
+
+    ~wav_writer() { close(); }
+
+    inline bool is_open() const { return m_file.is_open() && !m_file.fail(); }
+
+    inline size_t frames() const { return m_frames; }
+
+    bool write(T const *buf, size_t frames)
+    {
+        m_file.write((char const *)buf, frames * m_channels * sizeof(T));
+        m_frames += frames;
+        return !m_file.fail();
+    }
+
+    // Render up to “frames” frames from a stream, by chunks of a fixed size;
+    // returns the number of frames actually written.
+    size_t write(stream<T> &s, size_t frames, size_t chunk_frames = 4096)
+    {
+        m_chunk.resize(chunk_frames * m_channels);
+
+        size_t done = 0;
+        while (done < frames)
+        {
+            size_t const count = s.get(m_chunk.data(), std::min(chunk_frames, frames - done));
+            if (count == 0 || !write(m_chunk.data(), count))
+                break;
+            done += count;
+        }
+        return done;
+    }
+
+    bool close()
+    {
+        if (!m_file.is_open())
+            return false;
+
+        uint64_t const bytes = uint64_t(m_frames) * m_channels * sizeof(T);
+        uint32_t const data_size = uint32_t(std::min(bytes, uint64_t(0xffffffffu - 36)));
+        m_file.seekp(4);
+        put32(data_size + 36);
+        m_file.seekp(40);
+        put32(data_size);
+        m_file.close();
+        return !m_file.fail();
+    }
+
+protected:
+    void put16(uint16_t x)
+    {
+        char const tmp[] = { char(x), char(x >> 8) };
+        m_file.write(tmp, 2);
+    }
+
+    void put32(uint32_t x)
+    {
+        char const tmp[] = { char(x), char(x >> 8), char(x >> 16), char(x >> 24) };
+        m_file.write(tmp, 4);
+    }
+
+    std::ofstream m_file;
+    size_t m_channels;
+    size_t m_frames = 0;
+    std::vector<T> m_chunk;
+};
+
+// Open a WAV file as a stream of T samples; returns nullptr on failure
+template<typename T>
+static inline std::shared_ptr<wav_stream<T>> make_wav_stream(std::string const &path)
+{
+    auto file = std::make_unique<mapped_file>();
+    if (!file->open(path))
+        return nullptr;
+
+    auto info = wav::parse(file->data(), file->size());
+    if (!info)
+        return nullptr;
+
+    return std::make_shared<wav_stream<T>>(std::move(file), *info);
+}
+
+} // namespace lol::audio
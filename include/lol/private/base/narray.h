@@ -19,8 +19,12 @@
 //
 
 #include <lol/vector>  // lol::vec_t
-#include <vector>      // std::vector
-#include <utility>     // std::index_sequence
+#include <algorithm>   // std::max, std::min
+#include <cstddef>     // std::ptrdiff_t
+#include <iterator>    // std::forward_iterator_tag
+#include <memory>      // std::allocator_traits
+#include <new>         // std::align_val_t
+#include <utility>     // std::index_sequence, std::swap
 #include <type_traits> // std::remove_const
 
 namespace lol
@@ -28,11 +32,49 @@ namespace lol
 
 template<typename T, size_t N> class narray_span;
 
+//
+// Allocator for array storage, aligned to A bytes (or more if T requires
+// it), e.g. to a cache line or to the widest SIMD registers
+//
+
+template<typename T, size_t A = 64>
+class aligned_allocator
+{
+public:
+    using value_type = T;
+
+    static constexpr size_t alignment = std::max(A, alignof(T));
+
+    template<typename U>
+    struct rebind { using other = aligned_allocator<U, A>; };
+
+    aligned_allocator() = default;
+
+    template<typename U>
+    inline aligned_allocator(aligned_allocator<U, A> const &) {}
+
+    inline T *allocate(size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+    }
+
+    inline void deallocate(T *p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    template<typename U>
+    inline bool operator ==(aligned_allocator<U, A> const &) const { return true; }
+
+    template<typename U>
+    inline bool operator !=(aligned_allocator<U, A> const &) const { return false; }
+};
+
 //
 // Common base class for narray and narray_span
 //
 
-template<typename T, size_t N, template<typename, size_t> typename container_type>
+template<typename T, size_t N, typename container_type>
 class [[nodiscard]] narray_base
 {
 public:
@@ -48,7 +90,35 @@ public:
     inline size_t size() const { return size_helper(std::make_index_sequence<N>{}); }
     inline size_t bytes() const { return size() * sizeof(value_type); }
 
-    // Access element i in row-major fashion
+    // Distance in elements between consecutive elements along each dimension
+    inline vec_t<size_t, N> const &strides() const { return m_strides; }
+
+    // Whether the elements are stored one after the other in row-major
+    // order; kernels may then process them as a flat array
+    inline bool is_contiguous() const
+    {
+        size_t expected = 1;
+        for (size_t d = 0; d < N; ++d)
+        {
+            if (m_sizes[d] != 1 && m_strides[d] != expected)
+                return false;
+            expected *= m_sizes[d];
+        }
+        return true;
+    }
+
+    // Number of elements spanned in storage by the outermost dimension. For
+    // views that are not contiguous, this includes elements outside them.
+    inline size_t storage_size() const
+    {
+        size_t ret = 0;
+        for (size_t d = 0; d < N; ++d)
+            ret = std::max(ret, m_strides[d] * m_sizes[d]);
+        return ret;
+    }
+
+    // Access element i in storage order, which is row-major order for
+    // contiguous arrays
     inline value_type &operator[](size_t i)
     {
         return data()[i];
@@ -87,12 +157,12 @@ public:
     // Use CRTP to access data() from the child class
     inline value_type *data()
     {
-        return reinterpret_cast<container_type<T, N> &>(*this).data();
+        return static_cast<container_type &>(*this).data();
     }
 
     inline value_type const *data() const
     {
-        return reinterpret_cast<container_type<T, N> const &>(*this).data();
+        return static_cast<container_type const &>(*this).data();
     }
 
     // Create span (similar to std::span) with some const correctness
@@ -114,51 +184,62 @@ protected:
     }
 
     template<typename... I>
-    inline size_t offset(size_t i, I... indices) const
+    inline size_t offset(I... indices) const
     {
-        if constexpr(sizeof...(I) > 0)
-            i += m_sizes[N - sizeof...(I) - 1] * offset(indices...);
-        return i;
+        size_t const tmp[] = { size_t(indices)... };
+        return offset_helper(tmp, std::make_index_sequence<N>{});
     }
 
-    template <size_t... I>
-    inline size_t offset_helper(vec_t<int, N> const &sizes, std::index_sequence<I...>) const
+    template <typename V, size_t... I>
+    inline size_t offset_helper(V const &indices, std::index_sequence<I...>) const
     {
-        return offset(size_t(sizes[I])...);
+        return ((size_t(indices[I]) * m_strides[I]) + ... + 0);
     }
 
     vec_t<size_t, N> m_sizes { 0 };
+    vec_t<size_t, N> m_strides { 0 };
 };
 
 
 //
-// C++11 iterators
+// C++11 iterators, over storage: with padded rows, these also visit the
+// padding. Spans have their own iterators, see below.
 //
 
-template<typename T, size_t N, template<typename, size_t> typename U>
+template<typename T, size_t N, typename U>
 T *begin(narray_base<T, N, U> &a) { return a.data(); }
 
-template<typename T, size_t N, template<typename, size_t> typename U>
-T *end(narray_base<T, N, U> &a) { return a.data() + a.size(); }
+template<typename T, size_t N, typename U>
+T *end(narray_base<T, N, U> &a) { return a.data() + static_cast<U &>(a).storage_size(); }
 
-template<typename T, size_t N, template<typename, size_t> typename U>
+template<typename T, size_t N, typename U>
 T const *begin(narray_base<T, N, U> const &a) { return a.data(); }
 
-template<typename T, size_t N, template<typename, size_t> typename U>
-T const *end(narray_base<T, N, U> const &a) { return a.data() + a.size(); }
+template<typename T, size_t N, typename U>
+T const *end(narray_base<T, N, U> const &a) { return a.data() + static_cast<U const &>(a).storage_size(); }
 
 //
-// N-dimensional array
+// N-dimensional array. Storage comes from an allocator, by default aligned
+// to 64 bytes. Rows (the first dimension) may be padded to a multiple of a
+// number of elements so that kernels can process whole SIMD vectors without
+// handling tails, and so that every row starts aligned.
 //
 
-template<typename T, size_t N>
-class [[nodiscard]] narray : public narray_base<T, N, narray>
+template<typename T, size_t N, typename A = aligned_allocator<T>>
+class [[nodiscard]] narray : public narray_base<T, N, narray<T, N, A>>
 {
 public:
     using value_type = T;
+    using allocator_type = A;
 
     inline narray() = default;
-    inline ~narray() = default;
+
+    inline ~narray()
+    {
+        destroy(0, m_count);
+        if (m_data)
+            traits::deallocate(m_alloc, m_data, m_capacity);
+    }
 
     // Construct array with args: size1, size2, ..., sizen
     template<typename... I> inline narray(I... sizes)
@@ -173,59 +254,245 @@ public:
         resize(sizes);
     }
 
+    narray(narray const &that)
+      : m_alloc(traits::select_on_container_copy_construction(that.m_alloc)),
+        m_padding(that.m_padding),
+        m_pitch(that.m_pitch)
+    {
+        reserve(that.m_count);
+        for (; m_count < that.m_count; ++m_count)
+            traits::construct(m_alloc, m_data + m_count, that.m_data[m_count]);
+        this->m_sizes = that.m_sizes;
+        this->m_strides = that.m_strides;
+    }
+
+    narray(narray &&that) noexcept
+    {
+        swap(that);
+    }
+
+    narray &operator =(narray that)
+    {
+        swap(that);
+        return *this;
+    }
+
     // Empty array
     inline void clear() { resize(vec_t<size_t, N>(0)); }
 
-    // Resize array with a list of sizes (size1, size2, ..., sizen)
+    // Resize array with a list of sizes (size1, size2, ..., sizen). As with
+    // std::vector, elements are kept in storage order up to the new size,
+    // and new elements are value-initialised.
     template<typename... I>
     inline void resize(I... sizes)
     {
         static_assert(N == sizeof...(I));
-        this->m_sizes = { size_t(sizes)... };
-        m_data.resize(this->size());
+        reshape<true>(vec_t<size_t, N>{ size_t(sizes)... });
     }
 
     template<typename U>
     inline void resize(vec_t<U, N> const &sizes)
     {
-        this->m_sizes = vec_t<size_t, N>(sizes);
-        m_data.resize(this->size());
+        reshape<true>(vec_t<size_t, N>(sizes));
+    }
+
+    // Same as resize(), but new elements are default-initialised, which
+    // leaves them indeterminate for trivial types. This avoids clearing
+    // buffers that are about to be overwritten.
+    template<typename... I>
+    inline void resize_uninitialized(I... sizes)
+    {
+        static_assert(N == sizeof...(I));
+        reshape<false>(vec_t<size_t, N>{ size_t(sizes)... });
+    }
+
+    template<typename U>
+    inline void resize_uninitialized(vec_t<U, N> const &sizes)
+    {
+        reshape<false>(vec_t<size_t, N>(sizes));
+    }
+
+    // Pad rows to a multiple of this many elements from the next resize on;
+    // 1 disables padding
+    inline void set_row_padding(size_t multiple) { m_padding = std::max(multiple, size_t(1)); }
+    inline size_t row_padding() const { return m_padding; }
+
+    // Length of a row in storage, including padding
+    inline size_t pitch() const { return m_pitch; }
+
+    // Number of elements in storage, including row padding
+    inline size_t storage_size() const { return m_count; }
+
+    // Make room for this many elements, including row padding
+    void reserve(size_t count)
+    {
+        if (count <= m_capacity)
+            return;
+
+        T *data = traits::allocate(m_alloc, count);
+        for (size_t i = 0; i < m_count; ++i)
+            traits::construct(m_alloc, data + i, std::move(m_data[i]));
+        destroy(0, m_count);
+        if (m_data)
+            traits::deallocate(m_alloc, m_data, m_capacity);
+        m_data = data;
+        m_capacity = count;
+    }
+
+    void swap(narray &that) noexcept
+    {
+        using std::swap;
+        swap(m_alloc, that.m_alloc);
+        swap(m_data, that.m_data);
+        swap(m_count, that.m_count);
+        swap(m_capacity, that.m_capacity);
+        swap(m_padding, that.m_padding);
+        swap(m_pitch, that.m_pitch);
+        swap(this->m_sizes, that.m_sizes);
+        swap(this->m_strides, that.m_strides);
     }
 
+    inline allocator_type get_allocator() const { return m_alloc; }
+
     // Access data directly
-    inline value_type *data() { return m_data.data(); }
-    inline value_type const *data() const { return m_data.data(); }
+    inline value_type *data() { return m_data; }
+    inline value_type const *data() const { return m_data; }
 
 private:
-    std::vector<T> m_data;
+    using traits = std::allocator_traits<A>;
+
+    template<bool INIT>
+    void reshape(vec_t<size_t, N> const &sizes)
+    {
+        size_t const pitch = (sizes[0] + m_padding - 1) / m_padding * m_padding;
+        size_t count = pitch;
+        for (size_t d = 1; d < N; ++d)
+            count *= sizes[d];
+
+        reserve(count);
+        for (; m_count < count; ++m_count)
+        {
+            if constexpr (INIT)
+                traits::construct(m_alloc, m_data + m_count);
+            else
+                ::new (static_cast<void *>(m_data + m_count)) T;
+        }
+        destroy(count, m_count);
+        m_count = count;
+
+        m_pitch = pitch;
+        this->m_sizes = sizes;
+        this->m_strides[0] = 1;
+        for (size_t d = 1; d < N; ++d)
+            this->m_strides[d] = d == 1 ? pitch : this->m_strides[d - 1] * sizes[d - 1];
+    }
+
+    void destroy(size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            traits::destroy(m_alloc, m_data + i);
+    }
+
+    A m_alloc;
+    T *m_data = nullptr;
+    size_t m_count = 0, m_capacity = 0;
+    size_t m_padding = 1, m_pitch = 0;
 };
 
 template<typename T> using array2d = narray<T, 2>;
 template<typename T> using array3d = narray<T, 3>;
 
 //
-// N-dimensional array span
+// N-dimensional array span. Spans may view a whole array, or a region of it
+// with arbitrary strides, e.g. a tile, a slice, or a transposed array, none
+// of which requires copying data.
 //
 
 template<typename T, size_t N>
-class [[nodiscard]] narray_span : public narray_base<T, N, narray_span>
+class [[nodiscard]] narray_span : public narray_base<T, N, narray_span<T, N>>
 {
 public:
     using value_type = T;
 
-    template<template<typename, size_t> typename U>
+    template<typename U>
     inline narray_span(narray_base<T, N, U> &other)
       : m_data(other.data())
     {
         this->m_sizes = vec_t<size_t, N>(other.sizes());
+        this->m_strides = other.strides();
     }
 
     // Create an narray_span<T const> from a const narray_base<T>
-    template<template<typename, size_t> typename U, bool V = std::is_const<T>::value>
+    template<typename U, bool V = std::is_const<T>::value>
     inline narray_span(narray_base<typename std::remove_const<T>::type, N, U> const &other)
       : m_data(other.data())
     {
         this->m_sizes = vec_t<size_t, N>(other.sizes());
+        this->m_strides = other.strides();
+    }
+
+    // View existing data with the given sizes and strides
+    inline narray_span(T *data, vec_t<int, N> const &sizes, vec_t<size_t, N> const &strides)
+      : m_data(data)
+    {
+        this->m_sizes = vec_t<size_t, N>(sizes);
+        this->m_strides = strides;
+    }
+
+    // View contiguous data in row-major order
+    inline narray_span(T *data, vec_t<int, N> const &sizes)
+      : m_data(data)
+    {
+        this->m_sizes = vec_t<size_t, N>(sizes);
+        for (size_t d = 0; d < N; ++d)
+            this->m_strides[d] = d ? this->m_strides[d - 1] * this->m_sizes[d - 1] : 1;
+    }
+
+    // View the region of the given size starting at origin
+    inline narray_span subspan(vec_t<int, N> const &origin, vec_t<int, N> const &size) const
+    {
+        return narray_span(m_data + this->offset_helper(origin, std::make_index_sequence<N>{}),
+                           size, this->m_strides);
+    }
+
+    // View the elements whose index along the given dimension is index,
+    // e.g. one row of an image with slice(1, y)
+    inline narray_span<T, N - 1> slice(size_t axis, int index) const
+    {
+        static_assert(N > 1, "cannot slice a one-dimensional span");
+
+        vec_t<int, N - 1> sizes;
+        vec_t<size_t, N - 1> strides;
+        for (size_t d = 0, k = 0; d < N; ++d)
+            if (d != axis)
+            {
+                sizes[k] = int(this->m_sizes[d]);
+                strides[k++] = this->m_strides[d];
+            }
+        return narray_span<T, N - 1>(m_data + size_t(index) * this->m_strides[axis], sizes, strides);
+    }
+
+    // View with the dimensions reordered: dimension d of the result is
+    // dimension order[d] of this span
+    inline narray_span permute(vec_t<int, N> const &order) const
+    {
+        vec_t<int, N> sizes;
+        vec_t<size_t, N> strides;
+        for (size_t d = 0; d < N; ++d)
+        {
+            sizes[d] = int(this->m_sizes[order[d]]);
+            strides[d] = this->m_strides[order[d]];
+        }
+        return narray_span(m_data, sizes, strides);
+    }
+
+    // View with the dimensions in reverse order
+    inline narray_span transpose() const
+    {
+        vec_t<int, N> order;
+        for (size_t d = 0; d < N; ++d)
+            order[d] = int(N - 1 - d);
+        return permute(order);
     }
 
     // Access data directly
@@ -239,5 +506,85 @@ private:
 template<typename T> using span2d = narray_span<T, 2>;
 template<typename T> using span3d = narray_span<T, 3>;
 
+//
+// Iterator over the elements of a span in row-major order, following its
+// strides, so that only the elements of the view are visited
+//
+
+template<typename T, size_t N>
+class narray_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::remove_const_t<T>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
+    narray_iterator() = default;
+
+    inline narray_iterator(T *data, vec_t<size_t, N> const &sizes,
+                           vec_t<size_t, N> const &strides, size_t pos)
+      : m_data(data), m_sizes(sizes), m_strides(strides), m_pos(pos)
+    {}
+
+    inline reference operator *() const { return m_data[m_offset]; }
+    inline pointer operator ->() const { return m_data + m_offset; }
+
+    // Step along the innermost dimension, carrying into the outer ones at
+    // the end of each row
+    inline narray_iterator &operator ++()
+    {
+        ++m_pos;
+        m_offset += m_strides[0];
+        for (size_t d = 0; ++m_index[d] == m_sizes[d] && d + 1 < N; ++d)
+        {
+            m_index[d] = 0;
+            m_offset += m_strides[d + 1] - m_strides[d] * m_sizes[d];
+        }
+        return *this;
+    }
+
+    inline narray_iterator operator ++(int)
+    {
+        narray_iterator ret = *this;
+        ++*this;
+        return ret;
+    }
+
+    // Iterators over the same span compare by position
+    inline bool operator ==(narray_iterator const &that) const { return m_pos == that.m_pos; }
+    inline bool operator !=(narray_iterator const &that) const { return m_pos != that.m_pos; }
+
+private:
+    T *m_data = nullptr;
+    vec_t<size_t, N> m_sizes { 0 }, m_strides { 0 }, m_index { 0 };
+    size_t m_offset = 0, m_pos = 0;
+};
+
+template<typename T, size_t N>
+narray_iterator<T, N> begin(narray_span<T, N> &s)
+{
+    return narray_iterator<T, N>(s.data(), vec_t<size_t, N>(s.sizes()), s.strides(), 0);
+}
+
+template<typename T, size_t N>
+narray_iterator<T, N> end(narray_span<T, N> &s)
+{
+    return narray_iterator<T, N>(s.data(), vec_t<size_t, N>(s.sizes()), s.strides(), s.size());
+}
+
+template<typename T, size_t N>
+narray_iterator<T const, N> begin(narray_span<T, N> const &s)
+{
+    return narray_iterator<T const, N>(s.data(), vec_t<size_t, N>(s.sizes()), s.strides(), 0);
+}
+
+template<typename T, size_t N>
+narray_iterator<T const, N> end(narray_span<T, N> const &s)
+{
+    return narray_iterator<T const, N>(s.data(), vec_t<size_t, N>(s.sizes()), s.strides(), s.size());
+}
+
 } // namespace lol
 
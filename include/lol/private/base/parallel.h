@@ -0,0 +1,266 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Parallel algorithms
+// ———————————————————
+// Element-wise and tiled algorithms over narray_span, running on the global
+// thread pool.
+//
+
+#include <lol/vector>  // lol::vec_t
+#include <algorithm>   // std::max, std::min
+#include <cassert>     // assert()
+#include <cmath>       // std::pow
+#include <optional>    // std::optional
+#include <type_traits> // std::integral_constant
+#include <utility>     // std::forward
+#include <vector>      // std::vector
+
+#include "narray.h"             // lol::narray_span
+#include "../sys/threading.h"   // lol::thread_pool
+
+namespace lol::parallel
+{
+
+// Target working set of one chunk of an element-wise algorithm, and of one
+// tile of for_each_tile(); the latter is meant to fit in the L1 cache.
+static size_t const chunk_bytes = 64 * 1024;
+static size_t const tile_bytes = 32 * 1024;
+
+// Number of contiguous elements processed by each job of an element-wise
+// algorithm: a whole number of slabs along the outermost dimension, and
+// roughly chunk_bytes of data.
+template<typename T, size_t N>
+static inline size_t chunk_size(narray_span<T, N> const &s)
+{
+    size_t slab = 1;
+    for (size_t d = 0; d + 1 < N; ++d)
+        slab *= size_t(s.sizes()[d]);
+    // Empty arrays have no work, but callers still divide by the chunk size
+    if (slab == 0)
+        return 1;
+    size_t const wanted = std::max(chunk_bytes / sizeof(T), size_t(1));
+    return std::max((wanted + slab / 2) / slab, size_t(1)) * slab;
+}
+
+// Cache-sized tile for an array of elements of type T: the same power of two
+// in every dimension, except that the innermost dimension covers at least a
+// cache line. Tiles are clamped to the array size.
+template<typename T, size_t N>
+static inline vec_t<int, N> tile_size(vec_t<int, N> const &sizes)
+{
+    size_t const elements = std::max(tile_bytes / sizeof(T), size_t(1));
+    size_t side = 1;
+    while (std::pow(double(side * 2), double(N)) <= double(elements))
+        side *= 2;
+
+    vec_t<int, N> ret;
+    size_t const line = std::max(64 / sizeof(T), size_t(1));
+    size_t rest = elements;
+    for (size_t d = 0; d < N; ++d)
+    {
+        size_t n = d == 0 ? std::max(side, line) : side;
+        n = std::max(std::min(n, rest), size_t(1));
+        ret[d] = int(std::min(n, size_t(std::max(sizes[d], 1))));
+        rest = std::max(rest / size_t(ret[d]), size_t(1));
+    }
+    return ret;
+}
+
+// Storage offset of the element with row-major index i
+template<typename T, size_t N>
+static inline size_t element_offset(narray_span<T, N> const &s, size_t i)
+{
+    size_t ret = 0;
+    for (size_t d = 0; d < N; ++d)
+    {
+        size_t const n = size_t(s.sizes()[d]);
+        ret += i % n * s.strides()[d];
+        i /= n;
+    }
+    return ret;
+}
+
+// Call g(p, count, stride) for runs of elements covering the elements
+// [begin, end) in row-major order, where p points to the first element of
+// a run and stride is the distance between its elements. Unit strides are
+// passed as a std::integral_constant, so that g’s loops are specialised.
+template<typename T, size_t N, typename G>
+static inline void for_each_run(narray_span<T, N> s, size_t begin, size_t end, G &&g)
+{
+    std::integral_constant<size_t, 1> const unit;
+    if (s.is_contiguous())
+    {
+        g(s.data() + begin, end - begin, unit);
+        return;
+    }
+
+    size_t const row = size_t(s.sizes()[0]), stride = s.strides()[0];
+    for (size_t i = begin; i < end; )
+    {
+        size_t const count = std::min(end - i, row - i % row);
+        T *p = s.data() + element_offset(s, i);
+        if (stride == 1)
+            g(p, count, unit);
+        else
+            g(p, count, stride);
+        i += count;
+    }
+}
+
+// Call f(x) for every element x of the array
+template<typename T, size_t N, typename F>
+static inline void for_each(narray_span<T, N> s, F &&f)
+{
+    size_t const size = s.size(), chunk = chunk_size(s);
+
+    thread_pool::global().parallel_for(0, (size + chunk - 1) / chunk, [&](size_t c)
+    {
+        for_each_run(s, c * chunk, std::min(size, c * chunk + chunk), [&](T *p, size_t count, auto stride)
+        {
+            for (size_t i = 0; i < count; ++i)
+                f(p[i * stride]);
+        });
+    }, 1);
+}
+
+// Store f(x) into out for every element x of in; both arrays must have the
+// same sizes
+template<typename T, typename U, size_t N, typename F>
+static inline void transform(narray_span<T, N> in, narray_span<U, N> out, F &&f)
+{
+    assert(in.sizes() == out.sizes());
+
+    size_t const size = in.size(), chunk = chunk_size(in);
+    T *src = in.data();
+    U *dst = out.data();
+
+    thread_pool::global().parallel_for(0, (size + chunk - 1) / chunk, [&](size_t c)
+    {
+        size_t const begin = c * chunk, end = std::min(size, begin + chunk);
+        if (in.is_contiguous() && out.is_contiguous())
+        {
+            for (size_t i = begin; i < end; ++i)
+                dst[i] = f(src[i]);
+            return;
+        }
+
+        // Both arrays have the same sizes, so their rows match
+        size_t const row = size_t(in.sizes()[0]);
+        size_t const si = in.strides()[0], so = out.strides()[0];
+        for (size_t i = begin; i < end; )
+        {
+            size_t const count = std::min(end - i, row - i % row);
+            T *s = src + element_offset(in, i);
+            U *d = dst + element_offset(out, i);
+            if (si == 1 && so == 1)
+                for (size_t k = 0; k < count; ++k)
+                    d[k] = f(s[k]);
+            else
+                for (size_t k = 0; k < count; ++k)
+                    d[k * so] = f(s[k * si]);
+            i += count;
+        }
+    }, 1);
+}
+
+// Combine all elements with op, which must be associative. Partial results
+// are combined in a fixed order, so the result does not depend on the
+// scheduling, and init is only used once.
+template<typename T, size_t N, typename V, typename OP>
+static inline V reduce(narray_span<T, N> s, V init, OP &&op)
+{
+    size_t const size = s.size(), chunk = chunk_size(s);
+    size_t const chunks = (size + chunk - 1) / chunk;
+
+    std::vector<V> partial(chunks);
+    thread_pool::global().parallel_for(0, chunks, [&](size_t c)
+    {
+        std::optional<V> acc;
+        for_each_run(s, c * chunk, std::min(size, c * chunk + chunk), [&](T *p, size_t count, auto stride)
+        {
+            size_t i = 0;
+            if (!acc)
+                acc = V(p[i++]);
+            for (; i < count; ++i)
+                acc = op(*acc, p[i * stride]);
+        });
+        partial[c] = *acc;
+    }, 1);
+
+    for (auto const &v : partial)
+        init = op(init, v);
+    return init;
+}
+
+// Call f(origin, size) for every tile of the array, where origin and size
+// describe the tile in array coordinates; edge tiles may be smaller. If no
+// tile size is given, a cache-sized one is chosen from the element size.
+// The tile size is not used for deduction since vec_t takes an int size.
+template<typename T, size_t N, typename F>
+static inline void for_each_tile(narray_span<T, N> s, F &&f, vec_t<int, int(N)> tile = vec_t<int, int(N)>(0))
+{
+    vec_t<int, N> const sizes = s.sizes();
+    if (s.size() == 0)
+        return;
+
+    for (size_t d = 0; d < N; ++d)
+        if (tile[d] <= 0)
+        {
+            tile = tile_size<T, N>(sizes);
+            break;
+        }
+
+    vec_t<int, N> counts;
+    size_t total = 1;
+    for (size_t d = 0; d < N; ++d)
+    {
+        counts[d] = (sizes[d] + tile[d] - 1) / tile[d];
+        total *= size_t(counts[d]);
+    }
+
+    thread_pool::global().parallel_for(0, total, [&](size_t t)
+    {
+        vec_t<int, N> origin, size;
+        for (size_t d = 0; d < N; ++d)
+        {
+            origin[d] = int(t % size_t(counts[d])) * tile[d];
+            size[d] = std::min(tile[d], sizes[d] - origin[d]);
+            t /= size_t(counts[d]);
+        }
+        f(origin, size);
+    }, 1);
+}
+
+// Overloads for arrays, so that callers do not need to create spans
+template<typename T, size_t N, typename A, typename F>
+static inline void for_each(narray<T, N, A> &a, F &&f)
+{
+    for_each(a.span(), std::forward<F>(f));
+}
+
+template<typename T, typename U, size_t N, typename A, typename B, typename F>
+static inline void transform(narray<T, N, A> const &in, narray<U, N, B> &out, F &&f)
+{
+    transform(in.span(), out.span(), std::forward<F>(f));
+}
+
+template<typename T, size_t N, typename A, typename V, typename OP>
+static inline V reduce(narray<T, N, A> const &a, V init, OP &&op)
+{
+    return reduce(a.span(), init, std::forward<OP>(op));
+}
+
+} // namespace lol::parallel
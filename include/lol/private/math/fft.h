@@ -0,0 +1,198 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Fast Fourier transform
+// ——————————————————————
+//
+
+#include <cmath>   // std::cos, std::sin
+#include <cstddef> // size_t
+#include <vector>  // std::vector
+#include "../math/constants.h" // D_PI
+
+namespace lol
+{
+
+// Real-input FFT of a power-of-two size N ≥ 4. The spectrum has N/2 + 1
+// bins and is stored in split format (one array for real parts, one for
+// imaginary parts) so that spectral products vectorise well. The inverse
+// transform is normalised, i.e. inverse(forward(x)) == x.
+//
+// Internally this runs a complex FFT of size N/2 on the even/odd samples
+// packed as real/imaginary parts, using fused radix-4 passes and a single
+// radix-2 pass when log2(N/2) is odd, then untangles the result.
+template<typename T>
+class fft
+{
+public:
+    explicit fft(size_t size)
+      : m_size(size),
+        m_re(size / 2),
+        m_im(size / 2),
+        m_cos(size / 2),
+        m_sin(size / 2),
+        m_bitrev(size / 2)
+    {
+        for (size_t j = 0; j < size / 2; ++j)
+        {
+            double angle = 2.0 * D_PI * double(j) / double(size);
+            m_cos[j] = T(std::cos(angle));
+            m_sin[j] = T(std::sin(angle));
+        }
+
+        size_t const half = size / 2;
+        size_t bits = 0;
+        while ((size_t(1) << bits) < half)
+            ++bits;
+        for (size_t k = 0; k < half; ++k)
+        {
+            size_t r = 0;
+            for (size_t b = 0; b < bits; ++b)
+                r |= ((k >> b) & 1) << (bits - 1 - b);
+            m_bitrev[k] = r;
+        }
+    }
+
+    size_t size() const { return m_size; }
+    size_t bins() const { return m_size / 2 + 1; }
+
+    // Transform size() real samples into bins() complex values
+    void forward(T const *in, T *re, T *im)
+    {
+        size_t const half = m_size / 2;
+
+        for (size_t k = 0; k < half; ++k)
+        {
+            m_re[m_bitrev[k]] = in[2 * k];
+            m_im[m_bitrev[k]] = in[2 * k + 1];
+        }
+
+        transform(false);
+
+        // Untangle the spectra of the even and odd samples:
+        // X[k] = E[k] + w^k O[k]
+        re[0] = m_re[0] + m_im[0];
+        im[0] = T(0);
+        re[half] = m_re[0] - m_im[0];
+        im[half] = T(0);
+
+        for (size_t k = 1; k < half; ++k)
+        {
+            T ar = m_re[k], ai = m_im[k];
+            T br = m_re[half - k], bi = -m_im[half - k];
+            T er = T(0.5) * (ar + br), ei = T(0.5) * (ai + bi);
+            // O = (Z[k] - conj(Z[N/2-k])) / 2i
+            T orr = T(0.5) * (ai - bi), oi = T(-0.5) * (ar - br);
+            T wr = m_cos[k], wi = -m_sin[k];
+            re[k] = er + wr * orr - wi * oi;
+            im[k] = ei + wr * oi + wi * orr;
+        }
+    }
+
+    // Transform bins() complex values back into size() real samples
+    void inverse(T const *re, T const *im, T *out)
+    {
+        size_t const half = m_size / 2;
+
+        for (size_t k = 0; k < half; ++k)
+        {
+            T ar = re[k], ai = im[k];
+            T br = re[half - k], bi = -im[half - k];
+            T er = T(0.5) * (ar + br), ei = T(0.5) * (ai + bi);
+            // O = (X[k] - conj(X[N/2-k])) conj(w^k) / 2
+            T dr = T(0.5) * (ar - br), di = T(0.5) * (ai - bi);
+            T wr = m_cos[k], wi = m_sin[k];
+            T orr = dr * wr - di * wi, oi = dr * wi + di * wr;
+            // Z = E + i O
+            m_re[m_bitrev[k]] = er - oi;
+            m_im[m_bitrev[k]] = ei + orr;
+        }
+
+        transform(true);
+
+        T const scale = T(1) / T(half);
+        for (size_t k = 0; k < half; ++k)
+        {
+            out[2 * k] = m_re[k] * scale;
+            out[2 * k + 1] = m_im[k] * scale;
+        }
+    }
+
+private:
+    // In-place decimation-in-time complex FFT of size N/2 on bit-reversed
+    // input; the inverse transform is left unnormalised.
+    void transform(bool inverse)
+    {
+        size_t const half = m_size / 2;
+        T const s = inverse ? T(1) : T(-1);
+        T *xr = m_re.data(), *xi = m_im.data();
+
+        size_t h = 1;
+        size_t bits = 0;
+        while ((size_t(1) << bits) < half)
+            ++bits;
+
+        if (bits & 1)
+        {
+            for (size_t k = 0; k < half; k += 2)
+            {
+                T ar = xr[k], ai = xi[k];
+                xr[k] = ar + xr[k + 1]; xi[k] = ai + xi[k + 1];
+                xr[k + 1] = ar - xr[k + 1]; xi[k + 1] = ai - xi[k + 1];
+            }
+            h = 2;
+        }
+
+        // Each pass fuses two radix-2 stages of span h and 2h
+        for (; 4 * h <= half; h *= 4)
+        {
+            size_t const step1 = m_size / (2 * h), step2 = m_size / (4 * h);
+
+            for (size_t base = 0; base < half; base += 4 * h)
+            for (size_t k = 0; k < h; ++k)
+            {
+                size_t const i0 = base + k, i1 = i0 + h, i2 = i1 + h, i3 = i2 + h;
+
+                T w1r = m_cos[k * step1], w1i = s * m_sin[k * step1];
+                T w2r = m_cos[k * step2], w2i = s * m_sin[k * step2];
+
+                T br = xr[i1] * w1r - xi[i1] * w1i, bi = xr[i1] * w1i + xi[i1] * w1r;
+                T dr = xr[i3] * w1r - xi[i3] * w1i, di = xr[i3] * w1i + xi[i3] * w1r;
+
+                T a0r = xr[i0] + br, a0i = xi[i0] + bi;
+                T a1r = xr[i0] - br, a1i = xi[i0] - bi;
+                T c0r = xr[i2] + dr, c0i = xi[i2] + di;
+                T c1r = xr[i2] - dr, c1i = xi[i2] - di;
+
+                // W(4h)^k · c0, and W(4h)^(k+h) · c1 = W(4h)^k · (±i) · c1
+                T t0r = c0r * w2r - c0i * w2i, t0i = c0r * w2i + c0i * w2r;
+                T t1r = c1r * w2r - c1i * w2i, t1i = c1r * w2i + c1i * w2r;
+                T u1r = -s * t1i, u1i = s * t1r;
+
+                xr[i0] = a0r + t0r; xi[i0] = a0i + t0i;
+                xr[i2] = a0r - t0r; xi[i2] = a0i - t0i;
+                xr[i1] = a1r + u1r; xi[i1] = a1i + u1i;
+                xr[i3] = a1r - u1r; xi[i3] = a1i - u1i;
+            }
+        }
+    }
+
+    size_t m_size;
+    std::vector<T> m_re, m_im;
+    std::vector<T> m_cos, m_sin;
+    std::vector<size_t> m_bitrev;
+};
+
+} // namespace lol
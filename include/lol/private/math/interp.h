@@ -53,6 +53,18 @@ public:
 
     size_t const size() const { return SIZE; }
 
+    // Exact value of the kernel at distance x from the center; this is
+    // useful to build precomputed filter tables
+    static T weight(T x)
+    {
+        x = std::abs(x);
+        if (x >= m_center)
+            return T(0);
+
+        T dist = x * F_PI;
+        return dist ? m_center * std::sin(dist) * std::sin(dist / m_center) / (dist * dist) : T(1);
+    }
+
 private:
     static inline T const m_center = SIZE / 2;
     static inline T const m_scale = (SIZE * PRECISION - 1) / (m_center + 1);
@@ -18,7 +18,25 @@
 // These do not use std::filesystem yet because of the stdc++fs link requirement.
 //
 
+#include <cstddef> // size_t
+#include <cstdint> // uint8_t
 #include <fstream> // std::ofstream
+#include <string> // std::string
+
+#if _WIN32
+#   if !defined WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN 1
+#   endif
+#   if !defined NOMINMAX
+#       define NOMINMAX 1 // keep std::min and std::max usable
+#   endif
+#   include <windows.h> // CreateFileMapping, MapViewOfFile
+#else
+#   include <fcntl.h> // open
+#   include <sys/mman.h> // mmap
+#   include <sys/stat.h> // fstat
+#   include <unistd.h> // close
+#endif
 
 namespace lol
 {
@@ -51,5 +69,80 @@ private:
     file() = delete;
 };
 
+// A read-only memory mapping of a whole file
+class mapped_file
+{
+public:
+    mapped_file() = default;
+    mapped_file(mapped_file const &) = delete;
+    mapped_file &operator =(mapped_file const &) = delete;
+
+    ~mapped_file() { close(); }
+
+    bool open(std::string const &path)
+    {
+        close();
+#if _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        {
+            m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping)
+                m_data = (uint8_t const *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+            m_size = m_data ? size_t(size.QuadPart) : 0;
+        }
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void *p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                m_data = (uint8_t const *)p;
+                m_size = size_t(st.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+        return m_data != nullptr;
+    }
+
+    void close()
+    {
+#if _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        m_mapping = nullptr;
+#else
+        if (m_data)
+            munmap((void *)m_data, m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    inline uint8_t const *data() const { return m_data; }
+    inline size_t size() const { return m_size; }
+
+private:
+    uint8_t const *m_data = nullptr;
+    size_t m_size = 0;
+#if _WIN32
+    HANDLE m_mapping = nullptr;
+#endif
+};
+
 
 } // namespace lol::file
@@ -0,0 +1,308 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Profiling
+// —————————
+// Scoped timing zones and counters, recorded into per-thread buffers and
+// exported in the Chrome trace event format (chrome://tracing, Perfetto).
+// Each thread keeps its last profile::capacity events in a ring buffer, so
+// memory use stays bounded however long the program runs; older events are
+// overwritten.
+//
+
+#include <algorithm> // std::min, std::max
+#include <atomic>    // std::atomic
+#include <chrono>    // std::chrono::steady_clock
+#include <cstdint>   // int64_t, uint32_t
+#include <cstdio>    // std::snprintf
+#include <cstring>   // std::memcpy
+#include <string>    // std::string
+#include <vector>    // std::vector
+
+#include "file.h" // lol::file
+
+// Profiling is compiled out by defining LOL_PROFILE to 0, in which case the
+// macros below expand to nothing and their arguments are not evaluated.
+#if !defined LOL_PROFILE
+#   define LOL_PROFILE 1
+#endif
+
+#define LOL_PROFILE_CAT(a, b) LOL_PROFILE_CAT2(a, b)
+#define LOL_PROFILE_CAT2(a, b) a##b
+
+#if LOL_PROFILE
+#   define LOL_PROFILE_ZONE(name) ::lol::profile::zone LOL_PROFILE_CAT(lol_profile_zone_, __LINE__)(name)
+#   define LOL_PROFILE_COUNTER(name, value) ::lol::profile::counter(name, value)
+#else
+#   define LOL_PROFILE_ZONE(name) (void)0
+#   define LOL_PROFILE_COUNTER(name, value) (void)0
+#endif
+
+namespace lol
+{
+
+struct profile
+{
+    // Number of events kept per thread (1 MiB of storage per thread)
+    static constexpr size_t capacity = 32768;
+
+    // Nanoseconds elapsed since the first call, from std::chrono::steady_clock
+    static inline int64_t now()
+    {
+        static auto const origin = std::chrono::steady_clock::now();
+        auto const d = std::chrono::steady_clock::now() - origin;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    }
+
+    // Time the lifetime of this object. The name must outlive the profile
+    // data, which is the case for string literals.
+    class zone
+    {
+    public:
+        inline zone(char const *name)
+          : m_name(name),
+            m_start(now())
+        {}
+
+        inline ~zone()
+        {
+            event e { event::type::zone, m_name, m_start, {} };
+            e.duration = now() - m_start;
+            record(e);
+        }
+
+        zone(zone const &) = delete;
+        zone &operator =(zone const &) = delete;
+
+    private:
+        char const *m_name;
+        int64_t m_start;
+    };
+
+    // Record the current value of a counter
+    static inline void counter(char const *name, double value)
+    {
+        event e { event::type::counter, name, now(), {} };
+        e.value = value;
+        record(e);
+    }
+
+    // Name the calling thread in exported traces
+    static inline void thread_name(char const *name)
+    {
+        local().name.store(name, std::memory_order_release);
+    }
+
+    // Number of events currently kept by all threads
+    static size_t count()
+    {
+        size_t ret = 0;
+        for (auto *b = buffers().load(std::memory_order_acquire); b; b = b->next)
+            ret += std::min(b->written.load(std::memory_order_acquire), capacity);
+        return ret;
+    }
+
+    // Forget all recorded events. This must not be called while other
+    // threads are recording.
+    static void clear()
+    {
+        for (auto *b = buffers().load(std::memory_order_acquire); b; b = b->next)
+        {
+            b->oldest.store(0);
+            b->written.store(0);
+        }
+    }
+
+    // Export all events in the Chrome trace event format. This may be called
+    // while other threads are recording.
+    static std::string chrome_trace()
+    {
+        std::string ret = "{\"traceEvents\":[\n";
+        char buf[128];
+        bool first = true;
+
+        auto append = [&](char const *name, uint32_t tid)
+        {
+            ret += first ? "{\"name\":\"" : ",\n{\"name\":\"";
+            escape(ret, name);
+            std::snprintf(buf, sizeof(buf), "\",\"pid\":0,\"tid\":%u,", tid);
+            ret += buf;
+            first = false;
+        };
+
+        for (auto *b = buffers().load(std::memory_order_acquire); b; b = b->next)
+        {
+            if (char const *name = b->name.load(std::memory_order_acquire))
+            {
+                append("thread_name", b->id);
+                ret += "\"ph\":\"M\",\"args\":{\"name\":\"";
+                escape(ret, name);
+                ret += "\"}}";
+            }
+
+            // Copy the events first, then drop those that the owning thread
+            // may have overwritten in the meantime
+            size_t const end = b->written.load(std::memory_order_acquire);
+            size_t const first = std::max(b->oldest.load(std::memory_order_relaxed),
+                                          end > capacity ? end - capacity : 0);
+            std::vector<event> events;
+            events.reserve(end - first);
+            for (size_t i = first; i < end; ++i)
+                events.push_back(b->events[i % capacity].load());
+            std::atomic_thread_fence(std::memory_order_acquire);
+            size_t const valid = std::max(first, b->oldest.load(std::memory_order_relaxed));
+
+            for (size_t i = valid; i < end; ++i)
+            {
+                event const &e = events[i - first];
+                append(e.name, b->id);
+                if (e.kind == event::type::zone)
+                    std::snprintf(buf, sizeof(buf), "\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f}",
+                                  e.start * 1e-3, e.duration * 1e-3);
+                else
+                    std::snprintf(buf, sizeof(buf), "\"ph\":\"C\",\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+                                  e.start * 1e-3, e.value);
+                ret += buf;
+            }
+        }
+
+        ret += "\n],\"displayTimeUnit\":\"ns\"}\n";
+        return ret;
+    }
+
+    static inline bool export_chrome_trace(std::string const &path)
+    {
+        return file::write(path, chrome_trace());
+    }
+
+private:
+    profile() = delete;
+
+    struct event
+    {
+        enum class type : uint8_t { zone, counter };
+
+        type kind;
+        char const *name;
+        int64_t start;
+        union
+        {
+            int64_t duration;
+            double value;
+        };
+    };
+
+    // An event slot in a ring buffer. Exporters may read a slot while the
+    // owning thread overwrites it, so the fields are relaxed atomics; torn
+    // events are detected and dropped by the reader.
+    struct slot
+    {
+        void store(event const &e)
+        {
+            int64_t data;
+            std::memcpy(&data, &e.duration, sizeof(data));
+            kind.store(e.kind, std::memory_order_relaxed);
+            name.store(e.name, std::memory_order_relaxed);
+            start.store(e.start, std::memory_order_relaxed);
+            payload.store(data, std::memory_order_relaxed);
+        }
+
+        event load() const
+        {
+            event e { kind.load(std::memory_order_relaxed), name.load(std::memory_order_relaxed),
+                      start.load(std::memory_order_relaxed), {} };
+            int64_t const data = payload.load(std::memory_order_relaxed);
+            std::memcpy(&e.duration, &data, sizeof(data));
+            return e;
+        }
+
+        std::atomic<event::type> kind { event::type::zone };
+        std::atomic<char const *> name { nullptr };
+        std::atomic<int64_t> start { 0 }, payload { 0 };
+    };
+
+    // Events are only written by the owning thread. The number of events
+    // written is published with release semantics after each event, so that
+    // exporters can read everything below it without locking. Before a slot
+    // is reused, the index of the oldest valid event is advanced and fenced
+    // so that exporters reading that slot know to drop it.
+    //
+    // Buffers are never freed, so that events from threads that have
+    // exited can still be exported
+    struct thread_buffer
+    {
+        uint32_t id = 0;
+        std::atomic<char const *> name { nullptr };
+        std::atomic<size_t> written { 0 }, oldest { 0 };
+        slot events[capacity];
+        thread_buffer *next = nullptr;
+    };
+
+    static std::atomic<thread_buffer *> &buffers()
+    {
+        static std::atomic<thread_buffer *> head { nullptr };
+        return head;
+    }
+
+    static thread_buffer &local()
+    {
+        static thread_local thread_buffer *buf = nullptr;
+        if (!buf)
+        {
+            static std::atomic<uint32_t> ids { 0 };
+            buf = new thread_buffer;
+            buf->id = ids.fetch_add(1);
+
+            // Lock-free push at the head of the list of buffers
+            buf->next = buffers().load(std::memory_order_relaxed);
+            while (!buffers().compare_exchange_weak(buf->next, buf, std::memory_order_release,
+                                                    std::memory_order_relaxed))
+                ;
+        }
+        return *buf;
+    }
+
+    static inline void record(event const &e)
+    {
+        thread_buffer &b = local();
+        size_t const n = b.written.load(std::memory_order_relaxed);
+        if (n >= capacity)
+        {
+            b.oldest.store(n - capacity + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+        b.events[n % capacity].store(e);
+        b.written.store(n + 1, std::memory_order_release);
+    }
+
+    static void escape(std::string &out, char const *s)
+    {
+        for (; *s; ++s)
+        {
+            if (*s == '"' || *s == '\\')
+                out += '\\';
+            if ((unsigned char)*s < 0x20)
+            {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)*s);
+                out += buf;
+            }
+            else
+                out += *s;
+        }
+    }
+};
+
+} // namespace lol
@@ -0,0 +1,478 @@
+//
+//  Lol Engine
+//
+//  Copyright © 2010–2024 Sam Hocevar <sam@hocevar.net>
+//
+//  Lol Engine is free software. It comes without any warranty, to
+//  the extent permitted by applicable law. You can redistribute it
+//  and/or modify it under the terms of the Do What the Fuck You Want
+//  to Public License, Version 2, as published by the WTFPL Task Force.
+//  See http://www.wtfpl.net/ for more details.
+//
+
+#pragma once
+
+//
+// Coroutine tasks
+// ———————————————
+// Lazily started C++20 coroutines that can wait for other tasks, queue
+// elements and delays without blocking a thread. Nothing is defined when
+// the compiler does not support coroutines, and LOL_HAS_COROUTINES is 0.
+//
+
+#if defined __cpp_impl_coroutine && __has_include(<coroutine>)
+#   include <coroutine> // std::coroutine_handle, std::suspend_always
+#endif
+
+#if __cpp_lib_coroutine >= 201902L
+#   define LOL_HAS_COROUTINES 1
+#else
+#   define LOL_HAS_COROUTINES 0
+#endif
+
+#if LOL_HAS_COROUTINES
+
+#include <algorithm> // std::push_heap, std::pop_heap
+#include <chrono>    // std::chrono::steady_clock
+#include <condition_variable> // std::condition_variable
+#include <cstdint>   // int64_t, uint64_t
+#include <exception> // std::terminate
+#include <functional> // std::function
+#include <memory>    // std::shared_ptr
+#include <mutex>     // std::mutex
+#include <optional>  // std::optional
+#include <type_traits> // std::is_base_of_v
+#include <utility>   // std::move, std::exchange
+#include <vector>    // std::vector
+
+#include "threading.h" // lol::thread_pool, lol::queue, lol::timer
+
+namespace lol
+{
+
+template<typename T = void> class task;
+template<typename T> T sync_wait(task<T> t, thread_pool *executor = nullptr);
+
+// The part of a task promise that does not depend on the result type. Every
+// task has an executor: a thread pool on which it is started when awaited
+// from another executor, and on which it resumes after waiting for a queue
+// or a delay. A null executor means running on whichever thread completed
+// the wait. Tasks inherit the executor of the task that awaits them.
+struct task_promise_base
+{
+    // Signalled when a task started by sync_wait() completes
+    struct sync_state
+    {
+        void signal()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+            }
+            cond.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]{ return done; });
+        }
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool done = false;
+    };
+
+    // Resume the awaiting task by symmetric transfer, unless it runs on
+    // another executor, in which case it is scheduled there
+    struct final_awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            // Nothing in the frame may be used once the awaiting task or
+            // thread has been signalled, since it may destroy the frame
+            auto &p = h.promise();
+            std::coroutine_handle<> next = p.continuation;
+            thread_pool *ex = p.continuation_executor;
+
+            if (next && (!ex || ex == p.executor))
+                return next;
+            if (next)
+                resume(ex, next);
+            else if (auto state = p.sync)
+                state->signal();
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    // Exceptions are not used by this library
+    void unhandled_exception() { std::terminate(); }
+
+    // Executor of the coroutine behind h, if it is a task
+    template<typename P>
+    static thread_pool *executor_of(std::coroutine_handle<P> h)
+    {
+        if constexpr (std::is_base_of_v<task_promise_base, P>)
+            return h.promise().executor;
+        else
+            return nullptr;
+    }
+
+    // Resume h on an executor, or inline if there is none
+    static void resume(thread_pool *executor, std::coroutine_handle<> h)
+    {
+        if (executor)
+            executor->run([h]{ h.resume(); });
+        else
+            h.resume();
+    }
+
+    thread_pool *executor = nullptr;
+    std::coroutine_handle<> continuation;
+    thread_pool *continuation_executor = nullptr;
+    std::shared_ptr<sync_state> sync;
+};
+
+template<typename T>
+struct task_promise : task_promise_base
+{
+    void return_value(T value) { result.emplace(std::move(value)); }
+    T take() { return std::move(*result); }
+
+    std::optional<T> result;
+};
+
+template<>
+struct task_promise<void> : task_promise_base
+{
+    void return_void() {}
+    void take() {}
+};
+
+// A coroutine returning a T. Tasks are started lazily, either by awaiting
+// them from another task or by sync_wait(); awaiting a task transfers
+// control to it directly, and its completion transfers control back,
+// without going through a scheduler.
+template<typename T>
+class [[nodiscard]] task
+{
+public:
+    struct promise_type : task_promise<T>
+    {
+        task get_return_object() { return task(handle::from_promise(*this)); }
+    };
+
+    task(task &&that) noexcept
+      : m_handle(std::exchange(that.m_handle, {}))
+    {}
+
+    task &operator =(task &&that) noexcept
+    {
+        if (this != &that)
+        {
+            if (m_handle)
+                m_handle.destroy();
+            m_handle = std::exchange(that.m_handle, {});
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    task(task const &) = delete;
+    task &operator =(task const &) = delete;
+
+    inline bool valid() const { return bool(m_handle); }
+
+    // Run the task on the given executor instead of the awaiting task’s
+    task &&on(thread_pool &executor) &&
+    {
+        m_handle.promise().executor = &executor;
+        return std::move(*this);
+    }
+
+    auto operator co_await() && noexcept
+    {
+        return awaiter { m_handle };
+    }
+
+private:
+    using handle = std::coroutine_handle<promise_type>;
+
+    struct awaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> caller) noexcept
+        {
+            auto &p = h.promise();
+            thread_pool *ex = task_promise_base::executor_of(caller);
+            p.continuation = caller;
+            p.continuation_executor = ex;
+            if (!p.executor || p.executor == ex)
+            {
+                p.executor = ex;
+                return h;
+            }
+
+            // The caller’s frame, which holds this awaiter, may be gone as
+            // soon as the task is scheduled
+            task_promise_base::resume(p.executor, h);
+            return std::noop_coroutine();
+        }
+
+        T await_resume() { return h.promise().take(); }
+
+        handle h;
+    };
+
+    template<typename U> friend U sync_wait(task<U> t, thread_pool *executor);
+
+    explicit task(handle h) : m_handle(h) {}
+
+    handle m_handle;
+};
+
+// Run a task to completion and return its result, blocking the calling
+// thread. The task is started on the executor if one is given, otherwise
+// on the one set with task::on(), if any.
+template<typename T>
+T sync_wait(task<T> t, thread_pool *executor)
+{
+    auto h = t.m_handle;
+    auto state = std::make_shared<task_promise_base::sync_state>();
+    h.promise().sync = state;
+    if (executor)
+        h.promise().executor = executor;
+    task_promise_base::resume(h.promise().executor, h);
+    state->wait();
+    return h.promise().take();
+}
+
+// Move the awaiting task to an executor; it keeps resuming there after
+// waiting for queues or delays
+class resume_on
+{
+public:
+    explicit resume_on(thread_pool &executor)
+      : m_executor(executor)
+    {}
+
+    bool await_ready() noexcept { return false; }
+
+    template<typename P>
+    bool await_suspend(std::coroutine_handle<P> h)
+    {
+        if constexpr (std::is_base_of_v<task_promise_base, P>)
+            h.promise().executor = &m_executor;
+
+        // Jobs run inline on pools without workers, so just carry on
+        if (!m_executor.size())
+            return false;
+        m_executor.run([h]{ h.resume(); });
+        return true;
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    thread_pool &m_executor;
+};
+
+// Suspend the awaiting task for a given time. Expired delays are handled by
+// a single timer thread, which resumes the tasks on their executor. When
+// threads are disabled, the calling thread waits instead.
+class delay
+{
+public:
+    explicit delay(float seconds)
+      : m_ns(int64_t(double(seconds) * 1e9))
+    {}
+
+    bool await_ready()
+    {
+        if (m_ns <= 0)
+            return true;
+        if (thread::has_threads())
+            return false;
+        timer().wait_until(m_ns);
+        return true;
+    }
+
+    template<typename P>
+    void await_suspend(std::coroutine_handle<P> h)
+    {
+        thread_pool *ex = task_promise_base::executor_of(h);
+        scheduler::get().add(m_ns, [ex, h]{ task_promise_base::resume(ex, h); });
+    }
+
+    void await_resume() noexcept {}
+
+private:
+    class scheduler
+    {
+    public:
+        static scheduler &get()
+        {
+            static scheduler s;
+            return s;
+        }
+
+        // Pending callbacks are dropped on exit
+        ~scheduler()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cond.notify_all();
+        }
+
+        void add(int64_t ns, std::function<void()> fn)
+        {
+            auto const deadline = clock::now() + std::chrono::nanoseconds(ns);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_entries.push_back(entry { deadline, m_seq++, std::move(fn) });
+                std::push_heap(m_entries.begin(), m_entries.end());
+            }
+            m_cond.notify_one();
+        }
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        // Heap order: earliest deadline on top, then first scheduled
+        struct entry
+        {
+            bool operator <(entry const &that) const
+            {
+                return deadline != that.deadline ? deadline > that.deadline : seq > that.seq;
+            }
+
+            clock::time_point deadline;
+            uint64_t seq;
+            std::function<void()> fn;
+        };
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (!m_stop)
+            {
+                if (m_entries.empty())
+                {
+                    m_cond.wait(lock);
+                    continue;
+                }
+
+                auto const deadline = m_entries.front().deadline;
+                if (clock::now() < deadline)
+                {
+                    m_cond.wait_until(lock, deadline);
+                    continue;
+                }
+
+                std::pop_heap(m_entries.begin(), m_entries.end());
+                auto fn = std::move(m_entries.back().fn);
+                m_entries.pop_back();
+                lock.unlock();
+                fn();
+                lock.lock();
+            }
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<entry> m_entries;
+        uint64_t m_seq = 0;
+        bool m_stop = false;
+
+        // Started last and joined first, after m_stop is set
+        thread m_thread { [this](thread *) { run(); } };
+    };
+
+    int64_t m_ns;
+};
+
+// Pop an element from a queue, suspending the awaiting task instead of
+// blocking its thread while the queue is empty. The task is resumed by the
+// thread that pushes the element, or on its executor if it has one. A task
+// that is destroyed while waiting unregisters from the queue; it must not be
+// destroyed while it is being resumed.
+template<typename T, int N>
+class async_pop
+{
+public:
+    explicit async_pop(queue<T, N> &q)
+      : m_queue(q)
+    {}
+
+    ~async_pop()
+    {
+        if (m_id)
+            m_queue.cancel_push(m_id);
+    }
+
+    async_pop(async_pop const &) = delete;
+    async_pop &operator =(async_pop const &) = delete;
+
+    bool await_ready() { return m_queue.try_pop(m_value); }
+
+    template<typename P>
+    bool await_suspend(std::coroutine_handle<P> h)
+    {
+        m_handle = h;
+        m_executor = task_promise_base::executor_of(h);
+        return arm();
+    }
+
+    T await_resume() { return std::move(m_value); }
+
+private:
+    // Pop an element, or register for the next push; returns false if an
+    // element was popped. Another consumer may take the pushed element
+    // first, in which case we register again.
+    bool arm()
+    {
+        for (;;)
+        {
+            if (m_queue.try_pop(m_value))
+                return false;
+            if (m_queue.on_push([this]{ retry(); }, &m_id))
+                return true;
+        }
+    }
+
+    void retry()
+    {
+        m_id = 0;
+        if (!arm())
+            task_promise_base::resume(m_executor, m_handle);
+    }
+
+    queue<T, N> &m_queue;
+    T m_value;
+    std::coroutine_handle<> m_handle;
+    thread_pool *m_executor = nullptr;
+
+    // Registration with the queue while waiting for a push
+    uint64_t m_id = 0;
+};
+
+} // namespace lol
+
+#endif // LOL_HAS_COROUTINES
@@ -23,8 +23,42 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <algorithm> // std::min, std::max, std::find, std::stable_sort
+#include <atomic>  // std::atomic
 #include <chrono>  // std::chrono
 #include <cassert> // assert()
+#include <cstdint> // int64_t, intptr_t, uint32_t
+#include <cstdio>  // std::snprintf
+#include <deque>   // std::deque
+#include <memory>  // std::shared_ptr, std::unique_ptr
+#include <new>     // std::launder
+#include <optional> // std::optional
+#include <string>  // std::string
+#include <type_traits> // std::invoke_result_t
+#include <utility> // std::move, std::forward, std::pair
+#include <vector>  // std::vector
+
+#if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+#   define LOL_HAS_RDTSC 1
+#   if _MSC_VER
+#       include <intrin.h> // __rdtsc, __cpuid
+#   else
+#       include <cpuid.h> // __get_cpuid
+#       include <x86intrin.h> // __rdtsc
+#   endif
+#endif
+
+#if _WIN32
+#   if !defined WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN 1
+#   endif
+#   if !defined NOMINMAX
+#       define NOMINMAX 1 // keep std::min and std::max usable
+#   endif
+#   include <windows.h> // SetThreadAffinityMask
+#elif __linux__ && !__EMSCRIPTEN__
+#   include <sched.h> // sched_setaffinity
+#endif
 
 /* XXX: workaround for missing std::thread in mingw */
 #if _GLIBCXX_MUTEX && !_GLIBCXX_HAS_GTHREADS && _WIN32
@@ -63,6 +97,24 @@ public:
         return !disable_threads;
     }
 
+    // Pin the calling thread to one CPU. Returns false if the system does
+    // not support it or refused.
+    static bool pin(size_t cpu)
+    {
+#if _WIN32
+        auto const mask = DWORD_PTR(1) << (cpu % (8 * sizeof(DWORD_PTR)));
+        return SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif __linux__ && !__EMSCRIPTEN__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu % CPU_SETSIZE, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
 private:
     static void trampoline(thread *that)
     {
@@ -73,20 +125,6 @@ private:
     std::function<void(thread*)> m_function;
 };
 
-// This is like std::mutex but we can add debug information to it
-class mutex
-{
-public:
-    inline void lock() { m_mutex.lock(); }
-
-    inline bool try_lock() { return m_mutex.try_lock(); }
-
-    inline void unlock() { m_mutex.unlock(); }
-
-private:
-    std::mutex m_mutex;
-};
-
 // A FIFO queue for threads
 template<typename T, int N = 128>
 class queue
@@ -107,12 +145,7 @@ public:
 
         do_push(value); /* Push value */
 
-        if (thread::has_threads())
-        {
-            // Release lock and notify empty condition var (in that order)
-            uni_lock.unlock();
-            m_empty_cond.notify_one();
-        }
+        notify_push(uni_lock, 1);
     }
 
     // Will not block if another has already locked
@@ -132,12 +165,7 @@ public:
 
         do_push(value);
 
-        if (thread::has_threads())
-        {
-            // Release lock and notify empty condition var (in that order)
-            uni_lock.unlock();
-            m_empty_cond.notify_one();
-        }
+        notify_push(uni_lock, 1);
 
         return true;
     }
@@ -186,8 +214,184 @@ public:
         return true;
     }
 
+    // Push all elements of [first, last), moving them into the queue, and
+    // return how many were pushed. The lock is taken once for as many
+    // elements as fit; this only blocks if the queue becomes full. When
+    // threads are disabled, nothing can make room, so this stops instead.
+    template<typename IT>
+    size_t push_n(IT first, IT last)
+    {
+        size_t ret = 0;
+        while (first != last)
+        {
+            std::unique_lock<std::mutex> uni_lock(m_mutex);
+
+            if (thread::has_threads())
+                m_full_cond.wait(uni_lock, [&]{ return m_count < CAPACITY; });
+            else if (m_count == CAPACITY)
+                break;
+
+            int const count = do_push_n(first, last);
+            ret += size_t(count);
+
+            notify_push(uni_lock, count);
+        }
+        return ret;
+    }
+
+    // Push as many elements of [first, last) as fit without blocking, and
+    // return how many were pushed
+    template<typename IT>
+    size_t try_push_n(IT first, IT last)
+    {
+        std::unique_lock<std::mutex> uni_lock(m_mutex, std::defer_lock);
+
+        if (thread::has_threads())
+        {
+            if (!uni_lock.try_lock())
+                return 0;
+        }
+
+        int const count = do_push_n(first, last);
+
+        if (count)
+            notify_push(uni_lock, count);
+
+        return size_t(count);
+    }
+
+    // Pop between one and max elements into out; blocks until at least one
+    // element is available. Returns the number of elements popped.
+    template<typename OUT>
+    size_t pop_n(OUT out, size_t max)
+    {
+        assert(thread::has_threads());
+
+        std::unique_lock<std::mutex> uni_lock(m_mutex);
+        m_empty_cond.wait(uni_lock, [&]{ return m_count > 0; });
+
+        int const count = do_pop_n(out, max);
+
+        uni_lock.unlock();
+        notify(m_full_cond, count);
+
+        return size_t(count);
+    }
+
+    // Pop up to max elements into out without blocking, and return the
+    // number of elements popped
+    template<typename OUT>
+    size_t try_pop_n(OUT out, size_t max)
+    {
+        std::unique_lock<std::mutex> uni_lock(m_mutex, std::defer_lock);
+
+        if (thread::has_threads())
+        {
+            if (!uni_lock.try_lock())
+                return 0;
+        }
+
+        int const count = do_pop_n(out, max);
+
+        if (thread::has_threads() && count)
+        {
+            uni_lock.unlock();
+            notify(m_full_cond, count);
+        }
+
+        return size_t(count);
+    }
+
+    // Register fn to be called once, after the next push, unless the queue
+    // is not empty, in which case nothing is registered and false is
+    // returned. This lets coroutines wait for elements without blocking a
+    // thread; the callback runs on the pushing thread. If id is not null,
+    // it receives an id for cancel_push() before fn can possibly be called.
+    bool on_push(std::function<void()> fn, uint64_t *id = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_count > 0)
+            return false;
+        m_callbacks.emplace_back(++m_last_id, std::move(fn));
+        if (id)
+            *id = m_last_id;
+        return true;
+    }
+
+    // Unregister a callback; returns false if it was already called or is
+    // being called
+    bool cancel_push(uint64_t id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_callbacks.begin(); it != m_callbacks.end(); ++it)
+        {
+            if (it->first != id)
+                continue;
+            m_callbacks.erase(it);
+            return true;
+        }
+        return false;
+    }
+
     // Inner methods for actual update
 private:
+    // Release the lock, then wake the consumers waiting for count new
+    // elements: threads blocked in pop() and callbacks from on_push()
+    void notify_push(std::unique_lock<std::mutex> &uni_lock, int count)
+    {
+        std::vector<std::pair<uint64_t, std::function<void()>>> callbacks;
+        callbacks.swap(m_callbacks);
+
+        if (uni_lock.owns_lock())
+            uni_lock.unlock();
+        if (thread::has_threads())
+            notify(m_empty_cond, count);
+
+        for (auto &[id, fn] : callbacks)
+            fn();
+    }
+
+    // Wake one waiter per element, with a single call
+    static void notify(std::condition_variable &cond, int count)
+    {
+        if (count > 1)
+            cond.notify_all();
+        else
+            cond.notify_one();
+    }
+
+    // Move as many elements as fit, in at most two contiguous runs since
+    // the ring may wrap around; advances first past the moved elements
+    template<typename IT>
+    int do_push_n(IT &first, IT last)
+    {
+        int count = 0;
+        int const end = (m_start + m_count) % CAPACITY;
+        int const free = CAPACITY - m_count;
+        for (int run = 0, idx = end; run < 2 && count < free && first != last; ++run, idx = 0)
+        {
+            int const room = std::min(free - count, CAPACITY - idx);
+            int n = 0;
+            for (T *dst = m_values + idx; n < room && first != last; ++n, ++first)
+                dst[n] = std::move(*first);
+            count += n;
+        }
+        m_count += count;
+        return count;
+    }
+
+    template<typename OUT>
+    int do_pop_n(OUT &out, size_t max)
+    {
+        int const count = int(std::min(size_t(m_count), max));
+        int const first_run = std::min(count, CAPACITY - m_start);
+        out = std::move(m_values + m_start, m_values + m_start + first_run, out);
+        out = std::move(m_values, m_values + count - first_run, out);
+        m_start = (m_start + count) % CAPACITY;
+        m_count -= count;
+        return count;
+    }
+
     void do_push(T &value)
     {
         m_values[(m_start + m_count) % CAPACITY] = value;
@@ -209,39 +413,1187 @@ private:
 
     std::mutex m_mutex;
     std::condition_variable m_empty_cond, m_full_cond;
+    std::vector<std::pair<uint64_t, std::function<void()>>> m_callbacks;
+    uint64_t m_last_id = 0;
+};
+
+// A lock-free bounded multi-producer multi-consumer queue, using one sequence
+// number per slot as described by Dmitry Vyukov. Elements are moved in and
+// out, so move-only types without a default constructor are supported. The
+// blocking push() and pop() only fall back to waiting when the queue is full
+// or empty; waking up waiters costs nothing when there are none.
+template<typename T, size_t N = 128>
+class mpmc_queue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    mpmc_queue()
+    {
+        for (size_t i = 0; i < N; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    ~mpmc_queue()
+    {
+        size_t const tail = m_enqueue.load(std::memory_order_relaxed);
+        for (size_t pos = m_dequeue.load(std::memory_order_relaxed); pos != tail; ++pos)
+            std::launder(reinterpret_cast<T *>(m_cells[pos & (N - 1)].storage))->~T();
+    }
+
+    mpmc_queue(mpmc_queue const &) = delete;
+    mpmc_queue &operator =(mpmc_queue const &) = delete;
+
+    // Approximate number of elements, only exact when the queue is idle
+    size_t size() const
+    {
+        size_t const head = m_dequeue.load(std::memory_order_relaxed);
+        size_t const tail = m_enqueue.load(std::memory_order_relaxed);
+        return tail > head ? std::min(tail - head, N) : 0;
+    }
+
+    static constexpr size_t capacity() { return N; }
+
+    // Returns false immediately if the queue is full
+    template<typename U>
+    bool try_push(U &&value)
+    {
+        cell *c = nullptr;
+        size_t pos = m_enqueue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            c = &m_cells[pos & (N - 1)];
+            size_t const seq = c->seq.load(std::memory_order_acquire);
+            intptr_t const dif = intptr_t(seq) - intptr_t(pos);
+            if (dif == 0)
+            {
+                if (m_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = m_enqueue.load(std::memory_order_relaxed);
+        }
+
+        new (c->storage) T(std::forward<U>(value));
+        c->seq.store(pos + 1, std::memory_order_release);
+        m_not_empty.notify();
+        return true;
+    }
+
+    // Returns false immediately if the queue is empty
+    bool try_pop(T &ret)
+    {
+        return consume([&](T &&value) { ret = std::move(value); });
+    }
+
+    // Returns an empty optional immediately if the queue is empty; unlike
+    // the above, T does not need to be default-constructible
+    std::optional<T> try_pop()
+    {
+        std::optional<T> ret;
+        consume([&](T &&value) { ret.emplace(std::move(value)); });
+        return ret;
+    }
+
+    // Blocks while the queue is full
+    template<typename U>
+    void push(U &&value)
+    {
+        for (int n = 0; n < SPIN_COUNT; ++n, std::this_thread::yield())
+            if (try_push(std::forward<U>(value)))
+                return;
+
+        while (!try_push(std::forward<U>(value)))
+        {
+            uint32_t const epoch = m_not_full.prepare();
+            if (try_push(std::forward<U>(value)))
+            {
+                m_not_full.cancel();
+                return;
+            }
+            m_not_full.wait(epoch);
+        }
+    }
+
+    // Blocks while the queue is empty
+    T pop()
+    {
+        for (int n = 0; n < SPIN_COUNT; ++n, std::this_thread::yield())
+            if (auto ret = try_pop())
+                return std::move(*ret);
+
+        for (;;)
+        {
+            if (auto ret = try_pop())
+                return std::move(*ret);
+            uint32_t const epoch = m_not_empty.prepare();
+            if (auto ret = try_pop())
+            {
+                m_not_empty.cancel();
+                return std::move(*ret);
+            }
+            m_not_empty.wait(epoch);
+        }
+    }
+
+private:
+    // Number of attempts before a blocking call starts waiting
+    static int const SPIN_COUNT = 16;
+
+    // Claim the oldest element, pass it to f as an rvalue and destroy it.
+    // Returns false if the queue is empty.
+    template<typename F>
+    bool consume(F &&f)
+    {
+        cell *c = nullptr;
+        size_t pos = m_dequeue.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            c = &m_cells[pos & (N - 1)];
+            size_t const seq = c->seq.load(std::memory_order_acquire);
+            intptr_t const dif = intptr_t(seq) - intptr_t(pos + 1);
+            if (dif == 0)
+            {
+                if (m_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (dif < 0)
+                return false;
+            else
+                pos = m_dequeue.load(std::memory_order_relaxed);
+        }
+
+        T *p = std::launder(reinterpret_cast<T *>(c->storage));
+        f(std::move(*p));
+        p->~T();
+        c->seq.store(pos + N, std::memory_order_release);
+        m_not_full.notify();
+        return true;
+    }
+
+    // A futex-like wait point. Waiters register before their last attempt,
+    // and notifiers only touch the slow path if someone is registered; the
+    // two seq_cst fences make sure that either the waiter sees the new
+    // queue state or the notifier sees the waiter.
+    class wait_point
+    {
+    public:
+        uint32_t prepare()
+        {
+            m_waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            return m_epoch.load(std::memory_order_relaxed);
+        }
+
+        void cancel()
+        {
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void wait(uint32_t epoch)
+        {
+#if __cpp_lib_atomic_wait
+            m_epoch.wait(epoch, std::memory_order_relaxed);
+#else
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&]{ return m_epoch.load(std::memory_order_relaxed) != epoch; });
+#endif
+            m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!m_waiters.load(std::memory_order_relaxed))
+                return;
+
+            m_epoch.fetch_add(1, std::memory_order_relaxed);
+#if __cpp_lib_atomic_wait
+            m_epoch.notify_one();
+#else
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+            }
+            m_cond.notify_one();
+#endif
+        }
+
+    private:
+        std::atomic<uint32_t> m_epoch { 0 }, m_waiters { 0 };
+#if !__cpp_lib_atomic_wait
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+#endif
+    };
+
+    // One cache line per slot, so that producers and consumers working on
+    // neighbouring slots do not contend
+    struct alignas(64) cell
+    {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    alignas(64) cell m_cells[N];
+    alignas(64) std::atomic<size_t> m_enqueue { 0 };
+    alignas(64) std::atomic<size_t> m_dequeue { 0 };
+    alignas(64) wait_point m_not_empty, m_not_full;
+};
+
+// A fixed-capacity Chase-Lev work-stealing deque. Only the owner thread may
+// push and pop, at the bottom; any thread may steal from the top. Memory
+// orderings follow Lê, Pop, Cohen and Zappa Nardelli, “Correct and Efficient
+// Work-Stealing for Weak Memory Models” (PPoPP 2013).
+template<typename T, size_t N = 4096>
+class work_deque
+{
+    static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    size_t size() const
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? size_t(b - t) : 0;
+    }
+
+    // Returns false if the deque is full
+    bool push(T *x)
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if (b - t >= int64_t(N))
+            return false;
+        m_buffer[b & (N - 1)].store(x, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    T *pop()
+    {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        T *x = nullptr;
+        if (t <= b)
+        {
+            x = m_buffer[b & (N - 1)].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // Last item: race against thieves
+                if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed))
+                    x = nullptr;
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        return x;
+    }
+
+    // May fail spuriously when racing with other thieves or the owner
+    T *steal()
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        T *x = m_buffer[t & (N - 1)].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed))
+            return nullptr;
+        return x;
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> m_top { 0 };
+    alignas(64) std::atomic<int64_t> m_bottom { 0 };
+    std::atomic<T *> m_buffer[N];
+};
+
+template<typename T> class future;
+
+// A work-stealing thread pool. Each worker owns a deque: jobs scheduled from
+// a worker go to its own deque, jobs scheduled from other threads go to a
+// shared queue, and idle workers steal from each other. Threads waiting for
+// results help by running pending jobs.
+//
+// When threads are disabled (see thread::has_threads()) or the pool has no
+// workers, jobs run inline on the calling thread. Pinned workers are each
+// bound to one CPU, which keeps their caches warm.
+class thread_pool
+{
+public:
+    explicit thread_pool(size_t threads = std::thread::hardware_concurrency(), bool pinned = false)
+    {
+        m_size = thread::has_threads() ? threads : 0;
+        m_pinned = pinned;
+
+        // Workers only ever look at m_size, m_pinned and m_deques, which
+        // are set up before any of them starts
+        for (size_t i = 0; i < m_size; ++i)
+            m_deques.push_back(std::make_unique<work_deque<job>>());
+        m_threads.reserve(m_size);
+        for (size_t i = 0; i < m_size; ++i)
+            m_threads.push_back(std::make_unique<thread>([this, i](thread *) { worker(i); }));
+    }
+
+    // Pending jobs are run before the workers exit
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        m_threads.clear();
+    }
+
+    // A process-wide pool with one worker per hardware thread
+    static thread_pool &global()
+    {
+        static thread_pool pool;
+        return pool;
+    }
+
+    // Number of worker threads
+    inline size_t size() const { return m_size; }
+
+    // Schedule a job that does not return a result
+    void run(std::function<void()> fn)
+    {
+        if (!m_size)
+        {
+            fn();
+            return;
+        }
+
+        job *j = new job { std::move(fn) };
+        m_queued.fetch_add(1);
+
+        auto const &ctx = context();
+        if (ctx.pool != this || !m_deques[ctx.index]->push(j))
+        {
+            std::lock_guard<std::mutex> lock(m_external_mutex);
+            m_external.push_back(j);
+            m_external_count.fetch_add(1);
+        }
+
+        // Wake a worker only if one may be sleeping; this pairs with the
+        // sleeper count increment in worker()
+        if (m_sleeping.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+    }
+
+    // Schedule a job and get a future for its result
+    template<typename F>
+    auto submit(F &&f)
+    {
+        using R = std::invoke_result_t<F>;
+        auto state = std::make_shared<typename future<R>::state>(this);
+        run([state, f = std::forward<F>(f)]() mutable { state->fulfil(f); });
+        return future<R>(state);
+    }
+
+    // Call f(i) for every i in [begin, end). The range is cut into chunks of
+    // grain indices (by default, enough chunks for every worker to get eight)
+    // that are handed out to the workers and the calling thread.
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, F &&f, size_t grain = 0)
+    {
+        if (begin >= end)
+            return;
+
+        size_t const count = end - begin;
+        size_t const workers = m_size;
+        if (!grain)
+            grain = std::max(count / (8 * (workers + 1)), size_t(1));
+        size_t const chunks = (count + grain - 1) / grain;
+
+        if (!workers || chunks == 1)
+        {
+            for (size_t i = begin; i < end; ++i)
+                f(i);
+            return;
+        }
+
+        struct range_state
+        {
+            std::atomic<size_t> next { 0 }, done { 0 };
+        };
+
+        // Helper jobs that start after all chunks were handed out never
+        // touch f, so it can safely live on this stack frame.
+        auto state = std::make_shared<range_state>();
+        auto body = [state, begin, end, grain, chunks, fp = &f]()
+        {
+            for (size_t c; (c = state->next.fetch_add(1)) < chunks; )
+            {
+                size_t const lo = begin + c * grain, hi = std::min(end, lo + grain);
+                for (size_t i = lo; i < hi; ++i)
+                    (*fp)(i);
+                state->done.fetch_add(1, std::memory_order_release);
+            }
+        };
+
+        for (size_t n = 0; n < std::min(workers, chunks - 1); ++n)
+            run(body);
+        body();
+
+        while (state->done.load(std::memory_order_acquire) < chunks)
+            if (!run_one())
+                std::this_thread::yield();
+    }
+
+    // Run one pending job on the calling thread, if there is any
+    bool run_one()
+    {
+        job *j = take();
+        if (!j)
+            return false;
+        j->fn();
+        delete j;
+        return true;
+    }
+
+private:
+    struct job
+    {
+        std::function<void()> fn;
+    };
+
+    struct worker_context
+    {
+        thread_pool *pool = nullptr;
+        size_t index = 0;
+        uint32_t seed = 0;
+    };
+
+    static worker_context &context()
+    {
+        static thread_local worker_context ctx;
+        return ctx;
+    }
+
+    job *take()
+    {
+        if (!m_size || m_queued.load() <= 0)
+            return nullptr;
+
+        auto &ctx = context();
+        bool const is_worker = ctx.pool == this;
+        job *j = is_worker ? m_deques[ctx.index]->pop() : nullptr;
+
+        if (!j && m_external_count.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_external_mutex);
+            if (!m_external.empty())
+            {
+                j = m_external.front();
+                m_external.pop_front();
+                m_external_count.fetch_sub(1);
+            }
+        }
+
+        if (!j)
+        {
+            // Start stealing from a pseudo-random victim
+            size_t const n = m_deques.size();
+            ctx.seed = ctx.seed * 1664525u + 1013904223u;
+            size_t const start = size_t(ctx.seed >> 8) % n;
+            for (size_t k = 0; k < n && !j; ++k)
+            {
+                size_t const victim = (start + k) % n;
+                if (!is_worker || victim != ctx.index)
+                    j = m_deques[victim]->steal();
+            }
+        }
+
+        if (j)
+            m_queued.fetch_sub(1);
+        return j;
+    }
+
+    void worker(size_t index)
+    {
+        auto &ctx = context();
+        ctx.pool = this;
+        ctx.index = index;
+        ctx.seed = uint32_t(index) * 2654435761u;
+
+        if (m_pinned)
+            thread::pin(index % std::max(std::thread::hardware_concurrency(), 1u));
+
+        for (;;)
+        {
+            if (run_one())
+                continue;
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_sleeping.fetch_add(1);
+            m_cond.wait(lock, [&]{ return m_queued.load() > 0 || m_stop; });
+            m_sleeping.fetch_sub(1);
+            if (m_stop && m_queued.load() <= 0)
+                break;
+        }
+    }
+
+    size_t m_size = 0;
+    bool m_pinned = false;
+    std::vector<std::unique_ptr<work_deque<job>>> m_deques;
+    std::vector<std::unique_ptr<thread>> m_threads;
+
+    // Jobs scheduled from threads that are not workers of this pool
+    std::mutex m_external_mutex;
+    std::deque<job *> m_external;
+    std::atomic<int64_t> m_external_count { 0 };
+
+    // Number of jobs scheduled but not yet taken, and sleeping workers
+    std::atomic<int64_t> m_queued { 0 };
+    std::atomic<int64_t> m_sleeping { 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
+
+// The result of a job scheduled with thread_pool::submit(). Continuations
+// added with then() are scheduled on the same pool as soon as the result
+// is available.
+template<typename T>
+class future
+{
+public:
+    future() = default;
+
+    inline bool valid() const { return bool(m_state); }
+    inline bool ready() const { return m_state && m_state->ready.load(std::memory_order_acquire); }
+
+    // Wait for the result, running pending jobs of the pool meanwhile
+    void wait() const
+    {
+        while (!ready())
+        {
+            if (m_state->pool->run_one())
+                continue;
+            std::unique_lock<std::mutex> lock(m_state->mutex);
+            m_state->cond.wait_for(lock, std::chrono::milliseconds(1), [&]{ return ready(); });
+        }
+    }
+
+    T get() const
+    {
+        wait();
+        if constexpr (!std::is_void_v<T>)
+            return *m_state->value;
+    }
+
+    // Schedule f(result), or f() for future<void>, once the result is ready
+    template<typename F>
+    auto then(F &&f)
+    {
+        using A = std::add_lvalue_reference_t<std::add_const_t<T>>;
+        using R = typename std::conditional_t<std::is_void_v<T>, std::invoke_result<F>,
+                                              std::invoke_result<F, A>>::type;
+        auto next = std::make_shared<typename future<R>::state>(m_state->pool);
+        std::function<void()> fn = [prev = m_state, next, f = std::forward<F>(f)]() mutable
+        {
+            if constexpr (std::is_void_v<T>)
+                next->fulfil(f);
+            else
+                next->fulfil(f, *prev->value);
+        };
+
+        std::unique_lock<std::mutex> lock(m_state->mutex);
+        if (!m_state->ready.load(std::memory_order_relaxed))
+            m_state->continuations.push_back(std::move(fn));
+        else
+        {
+            lock.unlock();
+            m_state->pool->run(std::move(fn));
+        }
+        return future<R>(next);
+    }
+
+private:
+    friend class thread_pool;
+    template<typename U> friend class future;
+
+    struct state
+    {
+        state(thread_pool *p) : pool(p) {}
+
+        template<typename F, typename... A>
+        void fulfil(F &f, A const &...args)
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                f(args...);
+                value = true;
+            }
+            else
+                value = f(args...);
+
+            std::vector<std::function<void()>> next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready.store(true, std::memory_order_release);
+                next.swap(continuations);
+            }
+            cond.notify_all();
+            for (auto &fn : next)
+                pool->run(std::move(fn));
+        }
+
+        thread_pool *pool;
+        std::atomic<bool> ready { false };
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+        std::vector<std::function<void()>> continuations;
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+
+    future(std::shared_ptr<state> s) : m_state(s) {}
+
+    std::shared_ptr<state> m_state;
+};
+
+// An atomic count of unfinished jobs, which serves as a handle to a group of
+// jobs of a job_system. Jobs may be scheduled to start once a counter drops
+// to zero, which is how dependencies between groups are expressed. A counter
+// may be reused once it is back to zero, and must outlive its jobs.
+class job_counter
+{
+public:
+    job_counter() = default;
+
+    job_counter(job_counter const &) = delete;
+    job_counter &operator =(job_counter const &) = delete;
+
+    inline int64_t value() const { return m_value.load(std::memory_order_acquire); }
+    inline bool done() const { return value() == 0; }
+
+private:
+    friend class job_system;
+
+    std::atomic<int64_t> m_value { 0 };
+
+    // Protects the jobs waiting for zero, and the final decrement
+    std::mutex m_mutex;
+    std::vector<std::function<void()>> m_dependents;
+};
+
+// A job system for frame workloads made of many small jobs with
+// dependencies, running on a thread pool whose workers are pinned by
+// default. Waiting for a counter runs pending jobs instead of blocking, so
+// jobs may themselves wait for other jobs.
+class job_system
+{
+public:
+    explicit job_system(size_t threads = std::thread::hardware_concurrency(), bool pinned = true)
+      : m_pool(threads, pinned)
+    {}
+
+    // The underlying pool, e.g. to use as a task executor
+    inline thread_pool &pool() { return m_pool; }
+
+    // Number of worker threads
+    inline size_t size() const { return m_pool.size(); }
+
+    // Schedule f(). If done is given, it is incremented now and decremented
+    // once f has run. If after is given, f only starts once that counter
+    // drops to zero.
+    template<typename F>
+    void run(F &&f, job_counter *done = nullptr, job_counter *after = nullptr)
+    {
+        if (done)
+            done->m_value.fetch_add(1, std::memory_order_relaxed);
+
+        std::function<void()> fn = [this, f = std::forward<F>(f), done]() mutable
+        {
+            f();
+            if (done)
+                finish(*done);
+        };
+
+        if (after)
+            run_after(*after, std::move(fn));
+        else
+            m_pool.run(std::move(fn));
+    }
+
+    // Schedule f(i) for every i in [0, count), as one job per grain indices
+    template<typename F>
+    void run_n(size_t count, F &&f, job_counter *done = nullptr, job_counter *after = nullptr,
+               size_t grain = 1)
+    {
+        auto shared = std::make_shared<std::decay_t<F>>(std::forward<F>(f));
+        grain = std::max(grain, size_t(1));
+        for (size_t begin = 0; begin < count; begin += grain)
+        {
+            size_t const end = std::min(count, begin + grain);
+            run([shared, begin, end]
+            {
+                for (size_t i = begin; i < end; ++i)
+                    (*shared)(i);
+            }, done, after);
+        }
+    }
+
+    // Wait until the counter drops to value, running pending jobs meanwhile
+    void wait_for_counter(job_counter &c, int64_t value = 0)
+    {
+        while (c.value() > value)
+            if (!m_pool.run_one())
+                std::this_thread::yield();
+
+        // The job that brought the counter down may still hold its lock;
+        // wait for it so that the counter can be destroyed
+        std::lock_guard<std::mutex> lock(c.m_mutex);
+    }
+
+private:
+    void run_after(job_counter &c, std::function<void()> fn)
+    {
+        {
+            std::lock_guard<std::mutex> lock(c.m_mutex);
+            if (c.value() > 0)
+            {
+                c.m_dependents.push_back(std::move(fn));
+                return;
+            }
+        }
+        m_pool.run(std::move(fn));
+    }
+
+    void finish(job_counter &c)
+    {
+        // Only the last decrement needs the lock, to release dependents
+        int64_t v = c.m_value.load(std::memory_order_relaxed);
+        while (v > 1)
+            if (c.m_value.compare_exchange_weak(v, v - 1, std::memory_order_release,
+                                                std::memory_order_relaxed))
+                return;
+
+        std::vector<std::function<void()>> next;
+        {
+            std::lock_guard<std::mutex> lock(c.m_mutex);
+            if (c.m_value.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                next.swap(c.m_dependents);
+        }
+        for (auto &fn : next)
+            m_pool.run(std::move(fn));
+    }
+
+    thread_pool m_pool;
 };
 
 class timer
 {
 public:
-    inline timer() { (void)get_seconds(true); }
+    inline timer() { reset(); }
 
-    inline void reset() { (void)get_seconds(true); }
-    inline float get() { return get_seconds(true); }
-    inline float poll() { return get_seconds(false); }
+    inline void reset() { m_tp = std::chrono::steady_clock::now(); }
 
+    // Seconds elapsed since the last reset; get() also resets the timer.
+    // Use T = double for long-running timers.
+    template<typename T = float>
+    inline T get() { return T(double(get_ns(true)) * 1e-9); }
+
+    template<typename T = float>
+    inline T poll() { return T(double(get_ns(false)) * 1e-9); }
+
+    // Nanoseconds elapsed since the last reset; get_ns() also resets
+    inline int64_t get_ns() { return get_ns(true); }
+    inline int64_t poll_ns() { return get_ns(false); }
+
+    // Wait until the given time has elapsed since the last reset
     void wait(float seconds)
     {
         if (seconds > 0.0f)
+            wait_until(int64_t(double(seconds) * 1e9));
+    }
+
+    // Wait until the given number of nanoseconds has elapsed since the last
+    // reset. Sleeping overshoots by up to a scheduler tick, so this sleeps
+    // until a safety margin before the deadline and spins for the rest; the
+    // margin is calibrated from the observed sleep overshoot.
+    void wait_until(int64_t ns)
+    {
+        auto &margin = sleep_margin();
+
+        for (int64_t left = ns - get_ns(false); left > 0; left = ns - get_ns(false))
         {
-            float secs_elapsed = get_seconds(false);
-            std::this_thread::sleep_for(std::chrono::duration<float>(seconds - secs_elapsed));
+            int64_t const m = margin.load(std::memory_order_relaxed);
+            if (left <= m)
+            {
+                // Spin for the last part, yielding so as not to starve
+                // other threads on the same core
+                while (get_ns(false) < ns)
+                    std::this_thread::yield();
+                break;
+            }
+
+            int64_t const request = left - m;
+            int64_t const before = get_ns(false);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(request));
+            int64_t const overshoot = get_ns(false) - before - request;
+
+            // Follow overshoot increases immediately, and decreases slowly
+            int64_t next = overshoot > m ? overshoot : m + (overshoot - m) / 16;
+            margin.store(std::max(MIN_MARGIN, std::min(MAX_MARGIN, next)), std::memory_order_relaxed);
         }
     }
 
+    // Raw tick counter. On x86 CPUs with an invariant TSC this reads the time
+    // stamp counter, which is much cheaper than querying the steady clock;
+    // elsewhere it returns steady clock nanoseconds.
+    static inline uint64_t ticks()
+    {
+#if LOL_HAS_RDTSC
+        if (has_invariant_tsc())
+            return __rdtsc();
+#endif
+        return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Frequency of ticks(). When the TSC is used, it is calibrated against
+    // the steady clock on the first call, which takes about 20 milliseconds.
+    static double ticks_per_second()
+    {
+        static double const freq = []
+        {
+#if LOL_HAS_RDTSC
+            if (has_invariant_tsc())
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                uint64_t c0 = __rdtsc();
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                auto t1 = std::chrono::steady_clock::now();
+                uint64_t c1 = __rdtsc();
+                return double(c1 - c0) / std::chrono::duration<double>(t1 - t0).count();
+            }
+#endif
+            return 1e9;
+        }();
+        return freq;
+    }
+
+    // Whether the CPU time stamp counter runs at a constant rate across
+    // frequency changes and sleep states, and can be used by ticks()
+    static bool has_invariant_tsc()
+    {
+#if LOL_HAS_RDTSC
+        static bool const ret = []
+        {
+#   if _MSC_VER
+            int regs[4];
+            __cpuid(regs, 0x80000000);
+            if (unsigned(regs[0]) < 0x80000007u)
+                return false;
+            __cpuid(regs, 0x80000007);
+            return (regs[3] & (1 << 8)) != 0;
+#   else
+            unsigned a, b, c, d;
+            if (!__get_cpuid(0x80000007, &a, &b, &c, &d))
+                return false;
+            return (d & (1u << 8)) != 0;
+#   endif
+        }();
+        return ret;
+#else
+        return false;
+#endif
+    }
+
 private:
-    std::chrono::steady_clock::time_point m_tp;
+    static constexpr int64_t MIN_MARGIN = 50000;   // 50 µs
+    static constexpr int64_t MAX_MARGIN = 4000000; // 4 ms
+
+    // Shared by all timers, since it depends on the system scheduler
+    static std::atomic<int64_t> &sleep_margin()
+    {
+        static std::atomic<int64_t> margin { 500000 };
+        return margin;
+    }
 
-    float get_seconds(bool do_reset)
+    int64_t get_ns(bool do_reset)
     {
         auto tp = std::chrono::steady_clock::now(), tp0 = m_tp;
 
         if (do_reset)
             m_tp = tp;
 
-        return std::chrono::duration_cast<std::chrono::duration<float>>(tp - tp0).count();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(tp - tp0).count();
     }
+
+    std::chrono::steady_clock::time_point m_tp;
 };
 
+// Contention statistics for a named lock: number of acquisitions, how many
+// of them had to wait, total wait time and maximum hold time. All instances
+// are kept in a global registry that can be dumped.
+class lock_stats
+{
+public:
+    struct info
+    {
+        std::string name;
+        uint64_t acquisitions, contended;
+        double wait, max_hold; // in seconds
+    };
+
+    lock_stats(char const *name)
+      : m_name(name ? name : "")
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        registry().push_back(this);
+    }
+
+    ~lock_stats()
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        auto &r = registry();
+        r.erase(std::find(r.begin(), r.end(), this));
+    }
+
+    // Counters are only modified by the thread holding the lock, so they
+    // need no atomic read-modify-write; they are atomic so that they can be
+    // read at any time.
+    template<typename L>
+    void lock(L &l)
+    {
+        if (!l.try_lock())
+        {
+            uint64_t const t0 = timer::ticks();
+            l.lock();
+            add(m_wait, timer::ticks() - t0);
+            add(m_contended, 1);
+        }
+        add(m_acquisitions, 1);
+        m_locked_at = timer::ticks();
+    }
+
+    template<typename L>
+    bool try_lock(L &l)
+    {
+        if (!l.try_lock())
+            return false;
+        add(m_acquisitions, 1);
+        m_locked_at = timer::ticks();
+        return true;
+    }
+
+    template<typename L>
+    void unlock(L &l)
+    {
+        uint64_t const hold = timer::ticks() - m_locked_at;
+        if (hold > m_max_hold.load(std::memory_order_relaxed))
+            m_max_hold.store(hold, std::memory_order_relaxed);
+        l.unlock();
+    }
+
+    info get() const
+    {
+        double const scale = 1.0 / timer::ticks_per_second();
+        return info { m_name,
+                      m_acquisitions.load(std::memory_order_relaxed),
+                      m_contended.load(std::memory_order_relaxed),
+                      double(m_wait.load(std::memory_order_relaxed)) * scale,
+                      double(m_max_hold.load(std::memory_order_relaxed)) * scale };
+    }
+
+    // Statistics of all named locks, most waited for first
+    static std::vector<info> all()
+    {
+        std::vector<info> ret;
+        {
+            std::lock_guard<std::mutex> lock(registry_mutex());
+            for (auto const *s : registry())
+                ret.push_back(s->get());
+        }
+        std::stable_sort(ret.begin(), ret.end(), [](info const &a, info const &b) { return a.wait > b.wait; });
+        return ret;
+    }
+
+    // Human-readable table of all() for logs
+    static std::string dump()
+    {
+        std::string ret = "lock                             acquired  contended    wait (ms)  max hold (ms)\n";
+        char buf[160];
+        for (auto const &i : all())
+        {
+            std::snprintf(buf, sizeof(buf), "%-32s %8llu %10llu %12.3f %14.3f\n", i.name.c_str(),
+                          (unsigned long long)i.acquisitions, (unsigned long long)i.contended,
+                          i.wait * 1e3, i.max_hold * 1e3);
+            ret += buf;
+        }
+        return ret;
+    }
+
+private:
+    static void add(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::vector<lock_stats *> &registry()
+    {
+        static std::vector<lock_stats *> r;
+        return r;
+    }
+
+    std::string m_name;
+    std::atomic<uint64_t> m_acquisitions { 0 }, m_contended { 0 };
+    std::atomic<uint64_t> m_wait { 0 }, m_max_hold { 0 };
+    uint64_t m_locked_at = 0;
+};
+
+// A lock for short critical sections: waiters first spin for a while, then
+// park until the lock is released. The spin count adapts to how long the
+// lock was recently held, and spinning is disabled on single-core systems.
+// This is the three-state futex lock from Ulrich Drepper’s “Futexes Are
+// Tricky”: 0 is unlocked, 1 is locked, 2 is locked with possible waiters.
+class adaptive_lock
+{
+public:
+    inline bool try_lock()
+    {
+        uint32_t expected = 0;
+        return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                                               std::memory_order_relaxed);
+    }
+
+    inline void lock()
+    {
+        if (!try_lock())
+            lock_slow();
+    }
+
+    inline void unlock()
+    {
+        if (m_state.exchange(0, std::memory_order_release) == 2)
+        {
+#if __cpp_lib_atomic_wait
+            m_state.notify_one();
+#else
+            {
+                std::lock_guard<std::mutex> lock(m_park_mutex);
+            }
+            m_park_cond.notify_one();
+#endif
+        }
+    }
+
+private:
+    static constexpr int MAX_SPIN = 4000;
+
+    static inline void relax()
+    {
+#if LOL_HAS_RDTSC
+        _mm_pause();
+#elif defined __aarch64__ || defined __arm__
+        __asm__ __volatile__("yield");
+#endif
+    }
+
+    void lock_slow()
+    {
+        static bool const can_spin = std::thread::hardware_concurrency() > 1;
+
+        int const spin = m_spin.load(std::memory_order_relaxed);
+        int const limit = can_spin ? std::min(2 * spin + 16, MAX_SPIN) : 0;
+        for (int n = 0; n < limit; ++n)
+        {
+            relax();
+            if (m_state.load(std::memory_order_relaxed) == 0 && try_lock())
+            {
+                m_spin.store(spin + (n - spin) / 8, std::memory_order_relaxed);
+                return;
+            }
+        }
+        m_spin.store(spin + (limit - spin) / 8, std::memory_order_relaxed);
+
+        // Park, advertising that there is a waiter
+        while (m_state.exchange(2, std::memory_order_acquire) != 0)
+        {
+#if __cpp_lib_atomic_wait
+            m_state.wait(2, std::memory_order_relaxed);
+#else
+            std::unique_lock<std::mutex> lock(m_park_mutex);
+            m_park_cond.wait(lock, [&]{ return m_state.load(std::memory_order_relaxed) != 2; });
+#endif
+        }
+    }
+
+    std::atomic<uint32_t> m_state { 0 };
+    std::atomic<int> m_spin { 0 };
+#if !__cpp_lib_atomic_wait
+    std::mutex m_park_mutex;
+    std::condition_variable m_park_cond;
+#endif
+};
+
+// This is like std::mutex but we can add debug information to it: mutexes
+// that are given a name record contention statistics (see lock_stats).
+template<typename L>
+class basic_mutex
+{
+public:
+    basic_mutex() = default;
+
+    explicit basic_mutex(char const *name)
+      : m_stats(std::make_unique<lock_stats>(name))
+    {}
+
+    inline void lock()
+    {
+        if (m_stats)
+            m_stats->lock(m_lock);
+        else
+            m_lock.lock();
+    }
+
+    inline bool try_lock()
+    {
+        return m_stats ? m_stats->try_lock(m_lock) : m_lock.try_lock();
+    }
+
+    inline void unlock()
+    {
+        if (m_stats)
+            m_stats->unlock(m_lock);
+        else
+            m_lock.unlock();
+    }
+
+    // Statistics for this mutex, or nullptr if it has no name
+    inline lock_stats const *stats() const { return m_stats.get(); }
+
+private:
+    L m_lock;
+    std::unique_ptr<lock_stats> m_stats;
+};
+
+using mutex = basic_mutex<std::mutex>;
+using adaptive_mutex = basic_mutex<adaptive_lock>;
+
 } // namespace lol
 
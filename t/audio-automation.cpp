@@ -0,0 +1,131 @@
+#include <lol/lib/doctest>
+#include <lol/audio/automation>
+
+#include <cmath>
+#include <vector>
+
+TEST_CASE("param: constant value")
+{
+    lol::audio::param<float> p(0.5f);
+    std::vector<float> buf(64);
+    CHECK(p.render(buf.data(), buf.size()));
+    for (auto x : buf)
+        CHECK(x == 0.5f);
+    CHECK(p.frame() == 64);
+}
+
+TEST_CASE("param: sample-accurate set and linear ramp")
+{
+    lol::audio::param<float> p(0.0f);
+    p.set_at(1.0f, 10);
+    p.linear_to(3.0f, 30);
+
+    // Render in odd block sizes to cross the event boundaries
+    std::vector<float> buf(40);
+    CHECK(p.render(buf.data(), 7));
+    CHECK(!p.render(buf.data() + 7, 20));
+    CHECK(!p.render(buf.data() + 27, 13));
+
+    for (size_t n = 0; n < 10; ++n)
+        CHECK(buf[n] == 0.0f);
+    for (size_t n = 10; n < 30; ++n)
+        CHECK(buf[n] == doctest::Approx(1.0f + 2.0f * (n - 10) / 20.0f));
+    for (size_t n = 30; n < 40; ++n)
+        CHECK(buf[n] == 3.0f);
+    CHECK(p.pending() == 0);
+}
+
+TEST_CASE("param: ramp from the current value")
+{
+    lol::audio::param<float> p(2.0f);
+    std::vector<float> buf(100);
+    p.render(buf.data(), 50);
+
+    // The ramp starts where the parameter is now, not at frame 0
+    p.linear_to(0.0f, 60);
+    p.render(buf.data(), 20);
+    CHECK(buf[0] == 2.0f);
+    CHECK(buf[5] == doctest::Approx(1.0f));
+    CHECK(buf[10] == 0.0f);
+}
+
+TEST_CASE("param: exponential ramp")
+{
+    lol::audio::param<float> p(1.0f);
+    p.exponential_to(16.0f, 40);
+
+    std::vector<float> buf(50);
+    p.render(buf.data(), 13);
+    p.render(buf.data() + 13, 37);
+    for (size_t n = 0; n < 40; ++n)
+        CHECK(buf[n] == doctest::Approx(std::pow(2.0f, n / 10.0f)).epsilon(1e-4));
+    CHECK(buf[45] == 16.0f);
+
+    // Ramps towards zero cannot be exponential and fall back to linear
+    p.exponential_to(0.0f, 58);
+    p.render(buf.data(), 10);
+    CHECK(buf[4] == doctest::Approx(8.0f));
+}
+
+TEST_CASE("param: cancel and seek")
+{
+    lol::audio::param<float> p(0.0f);
+    p.set_at(1.0f, 10);
+    p.set_at(2.0f, 20);
+    p.cancel(15);
+    CHECK(p.pending() == 1);
+
+    p.seek(100);
+    CHECK(p.value() == 1.0f);
+    CHECK(p.frame() == 100);
+}
+
+TEST_CASE("gain: automated fade out")
+{
+    auto src = lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        std::fill(buf, buf + 2 * frames, int16_t(10000));
+        return frames;
+    }, 2, 48000);
+
+    auto g = lol::audio::make_gain(src);
+    g->amount().linear_to(0.0f, 100);
+
+    std::vector<int16_t> buf(2 * 128);
+    CHECK(g->get(buf.data(), 128) == 128);
+    CHECK(buf[0] == 10000);
+    CHECK(buf[1] == 10000);
+    CHECK(std::abs(buf[2 * 50] - 5000) <= 1);
+    CHECK(buf[2 * 50] == buf[2 * 50 + 1]);
+    CHECK(buf[2 * 100] == 0);
+    CHECK(buf[2 * 127] == 0);
+}
+
+TEST_CASE("pan: constant power")
+{
+    auto src = lol::audio::make_generator<float>([](float *buf, size_t frames)
+    {
+        std::fill(buf, buf + 2 * frames, 1.0f);
+        return frames;
+    }, 2, 48000);
+
+    auto p = lol::audio::make_pan(src);
+    std::vector<float> buf(2 * 16);
+
+    // Centre leaves the stream untouched
+    p->get(buf.data(), 16);
+    for (auto x : buf)
+        CHECK(x == 1.0f);
+
+    // Hard right
+    p->position().set(1.0f);
+    p->get(buf.data(), 16);
+    CHECK(std::abs(buf[0]) < 1e-6f);
+    CHECK(buf[1] == doctest::Approx(std::sqrt(2.0f)));
+
+    // Halfway left: total power is preserved
+    p->position().set(-0.5f);
+    p->get(buf.data(), 16);
+    CHECK(buf[0] * buf[0] + buf[1] * buf[1] == doctest::Approx(2.0f));
+    CHECK(buf[0] > buf[1]);
+}
@@ -1,6 +1,9 @@
 #include <lol/lib/doctest>
 #include <lol/audio/stream>
 
+#include <cstring>
+#include <vector>
+
 TEST_CASE("sample conversion: float|double ←→ float|double")
 {
     auto cv1 = lol::audio::sample::convert<float, float>;
@@ -233,3 +236,60 @@ TEST_CASE("sample conversion: uint8 → float → uint8")
         CHECK(cv2(cv1(n)) == n);
     }
 }
+
+template<typename FROM, typename TO>
+static void check_convert_n(std::vector<FROM> const &src)
+{
+    // Use an odd size to exercise the scalar tail of the SIMD kernels
+    std::vector<TO> dst(src.size());
+    lol::audio::sample::convert_n(src.data(), dst.data(), src.size());
+    for (size_t n = 0; n < src.size(); ++n)
+    {
+        CAPTURE(n);
+        TO expected = lol::audio::sample::convert<FROM, TO>(src[n]);
+        CHECK(std::memcmp(&dst[n], &expected, sizeof(TO)) == 0);
+    }
+}
+
+TEST_CASE("sample batch conversion: same results as scalar conversion")
+{
+    std::vector<int8_t> s8;
+    std::vector<uint8_t> u8;
+    for (int n = 0; n < 0x100 + 7; ++n)
+    {
+        s8.push_back(int8_t(n));
+        u8.push_back(uint8_t(n));
+    }
+    check_convert_n<int8_t, uint8_t>(s8);
+    check_convert_n<uint8_t, int8_t>(u8);
+    check_convert_n<uint8_t, int16_t>(u8);
+    check_convert_n<int8_t, float>(s8);
+
+    std::vector<int16_t> s16;
+    std::vector<uint16_t> u16;
+    for (int n = 0; n < 0x10000 + 7; ++n)
+    {
+        s16.push_back(int16_t(n));
+        u16.push_back(uint16_t(n));
+    }
+    check_convert_n<int16_t, uint16_t>(s16);
+    check_convert_n<uint16_t, int16_t>(u16);
+    check_convert_n<int16_t, int8_t>(s16);
+    check_convert_n<int16_t, float>(s16);
+    check_convert_n<uint16_t, float>(u16);
+
+    std::vector<float> f;
+    for (int n = -0x14000; n < 0x14000 + 7; ++n)
+        f.push_back(n / float(0x10000));
+    f.push_back(std::numeric_limits<float>::quiet_NaN());
+    f.push_back(std::numeric_limits<float>::infinity());
+    f.push_back(-std::numeric_limits<float>::infinity());
+    check_convert_n<float, int16_t>(f);
+    check_convert_n<float, uint16_t>(f);
+    check_convert_n<float, int8_t>(f);
+    check_convert_n<float, double>(f);
+    check_convert_n<float, float>(f);
+
+    std::vector<double> d(f.begin(), f.end());
+    check_convert_n<double, float>(d);
+}
@@ -0,0 +1,159 @@
+#include <lol/lib/doctest>
+#include <lol/audio/convolver>
+#include <lol/math>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// A seekable stereo stream of pseudo-random samples
+class noise : public lol::audio::stream<float>
+{
+public:
+    noise(size_t size)
+      : lol::audio::stream<float>(2, 48000), m_size(size)
+    {}
+
+    static float at(size_t n, size_t ch)
+    {
+        uint32_t x = uint32_t(n * 2 + ch) * 2654435761u;
+        x ^= x >> 15;
+        return float(x & 0xffff) / 32768.0f - 1.0f;
+    }
+
+    virtual size_t get(float *buf, size_t frames) override
+    {
+        for (size_t n = 0; n < frames; ++n, ++m_pos)
+        {
+            *buf++ = m_pos < m_size ? at(m_pos, 0) : 0.0f;
+            *buf++ = m_pos < m_size ? at(m_pos, 1) : 0.0f;
+        }
+        return frames;
+    }
+
+    virtual std::optional<size_t> size() const override { return m_size; }
+    virtual std::optional<size_t> pos() const override { return m_pos; }
+    virtual bool seek(size_t pos) override { m_pos = pos; return true; }
+
+private:
+    size_t m_pos = 0, m_size;
+};
+
+// Direct convolution of a noise stream of the given size with a mono
+// impulse response
+static float direct(std::vector<float> const &ir, size_t size, size_t n, size_t ch)
+{
+    double ret = 0.0;
+    for (size_t k = 0; k < ir.size() && k <= n; ++k)
+        if (n - k < size)
+            ret += ir[k] * noise::at(n - k, ch);
+    return float(ret);
+}
+
+TEST_CASE("fft: matches a naive DFT")
+{
+    for (size_t size : { 4, 8, 16, 32, 64, 128, 1024 })
+    {
+        lol::fft<double> f(size);
+        std::vector<double> in(size), re(f.bins()), im(f.bins()), out(size);
+        for (size_t n = 0; n < size; ++n)
+            in[n] = noise::at(n, 0);
+
+        f.forward(in.data(), re.data(), im.data());
+        for (size_t k = 0; k < f.bins(); ++k)
+        {
+            double dr = 0.0, di = 0.0;
+            for (size_t n = 0; n < size; ++n)
+            {
+                dr += in[n] * std::cos(2.0 * lol::D_PI * double(k * n) / double(size));
+                di -= in[n] * std::sin(2.0 * lol::D_PI * double(k * n) / double(size));
+            }
+            CHECK(std::abs(re[k] - dr) < 1e-9);
+            CHECK(std::abs(im[k] - di) < 1e-9);
+        }
+
+        f.inverse(re.data(), im.data(), out.data());
+        for (size_t n = 0; n < size; ++n)
+            CHECK(std::abs(out[n] - in[n]) < 1e-12);
+    }
+}
+
+TEST_CASE("convolver: matches direct convolution")
+{
+    // A mono decaying impulse response spanning several partitions
+    std::vector<float> ir(1000);
+    for (size_t n = 0; n < ir.size(); ++n)
+        ir[n] = std::exp(-0.005f * n) * noise::at(n, 1);
+
+    auto c = lol::audio::make_convolver(std::make_shared<noise>(5000), ir, 1, 128);
+    CHECK(c->block_frames() == 128);
+    CHECK(c->ir_frames() == 1000);
+
+    // Odd read sizes to cross block boundaries
+    std::vector<float> buf(2 * 6000);
+    for (size_t done = 0; done < 6000; )
+    {
+        size_t count = std::min(size_t(333), 6000 - done);
+        CHECK(c->get(buf.data() + 2 * done, count) == count);
+        done += count;
+    }
+    CHECK(c->pos() == 6000);
+
+    float max_error = 0.0f;
+    for (size_t n = 0; n < 6000; ++n)
+    for (size_t ch = 0; ch < 2; ++ch)
+        max_error = std::max(max_error, std::abs(buf[2 * n + ch] - direct(ir, 5000, n, ch)));
+    CHECK(max_error < 1e-4f);
+}
+
+TEST_CASE("convolver: per-channel impulse responses")
+{
+    // Left channel is delayed by 3 frames, right channel is inverted
+    std::vector<float> ir(2 * 8, 0.0f);
+    ir[2 * 3] = 1.0f;
+    ir[1] = -1.0f;
+
+    auto c = lol::audio::make_convolver(std::make_shared<noise>(1000), ir, 2, 64);
+    std::vector<float> buf(2 * 200);
+    c->get(buf.data(), 200);
+
+    for (size_t n = 0; n < 200; ++n)
+    {
+        CHECK(std::abs(buf[2 * n] - (n >= 3 ? noise::at(n - 3, 0) : 0.0f)) < 1e-5f);
+        CHECK(std::abs(buf[2 * n + 1] + noise::at(n, 1)) < 1e-5f);
+    }
+}
+
+TEST_CASE("convolver: seek matches continuous playback")
+{
+    std::vector<float> ir(300);
+    for (size_t n = 0; n < ir.size(); ++n)
+        ir[n] = std::exp(-0.01f * n) * noise::at(n, 0);
+
+    auto c = lol::audio::make_convolver(std::make_shared<noise>(4000), ir, 1, 64);
+    std::vector<float> ref(2 * 3000), buf(2 * 1000);
+    c->get(ref.data(), 3000);
+
+    CHECK(c->seek(1777));
+    CHECK(c->pos() == 1777);
+    c->get(buf.data(), 1000);
+    for (size_t n = 0; n < 2 * 1000; ++n)
+        CHECK(std::abs(buf[n] - ref[2 * 1777 + n]) < 1e-4f);
+}
+
+TEST_CASE("convolver: integer samples")
+{
+    auto src = lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames, int16_t(1000));
+        return frames;
+    }, 1, 44100);
+
+    // Two taps of 0.5 sum to unity gain once the first frame has passed
+    auto c = lol::audio::make_convolver(src, std::vector<float>{ 0.5f, 0.5f }, 1, 32);
+    std::vector<int16_t> buf(100);
+    c->get(buf.data(), buf.size());
+    CHECK(buf[0] == 500);
+    for (size_t n = 1; n < buf.size(); ++n)
+        CHECK(buf[n] == 1000);
+}
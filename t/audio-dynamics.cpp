@@ -0,0 +1,98 @@
+#include <lol/lib/doctest>
+#include <lol/audio/dynamics>
+
+#include <cmath>
+#include <vector>
+
+TEST_CASE("fast tanh: error bound")
+{
+    float max_error = 0.0f;
+    for (float x = -20.0f; x <= 20.0f; x += 1e-4f)
+        max_error = std::max(max_error, std::abs(lol::audio::sample::fast_tanh(x) - std::tanh(x)));
+    CHECK(max_error < 1e-4f);
+
+    CHECK(lol::audio::sample::fast_tanh(0.0f) == 0.0f);
+    CHECK(lol::audio::sample::fast_tanh(1e30f) == 1.0f);
+    CHECK(lol::audio::sample::fast_tanh(-1e30f) == -1.0f);
+}
+
+TEST_CASE("limiter: peaks never exceed the threshold")
+{
+    // A quiet sine wave with a loud burst in the middle
+    auto src = lol::audio::make_generator<float>([n = 0](float *buf, size_t frames) mutable
+    {
+        for (size_t f = 0; f < frames; ++f, ++n)
+        {
+            float gain = n >= 10000 && n < 12000 ? 4.0f : 0.25f;
+            buf[2 * f] = buf[2 * f + 1] = gain * std::sin(0.05f * n);
+        }
+        return frames;
+    }, 2, 48000);
+
+    auto l = lol::audio::make_limiter(src, 0.5f, 0.005f, 0.001f, 0.05f);
+    CHECK(l->latency() == 240);
+
+    std::vector<float> buf(2 * 48000);
+    l->get(buf.data(), 48000);
+
+    float max_peak = 0.0f;
+    for (auto x : buf)
+        max_peak = std::max(max_peak, std::abs(x));
+    CHECK(max_peak <= 0.5f);
+
+    // Before the burst, the signal is simply delayed
+    for (int n = 240; n < 9000; ++n)
+        CHECK(std::abs(buf[2 * n] - 0.25f * std::sin(0.05f * (n - 240))) < 1e-5f);
+
+    // After the release, the gain is back to unity
+    for (int n = 30000; n < 48000; ++n)
+        CHECK(std::abs(buf[2 * n] - 0.25f * std::sin(0.05f * (n - 240))) < 1e-3f);
+}
+
+TEST_CASE("limiter: seeking primes the delay line")
+{
+    class ramp : public lol::audio::stream<float>
+    {
+    public:
+        ramp() : lol::audio::stream<float>(1, 48000) {}
+
+        virtual size_t get(float *buf, size_t frames) override
+        {
+            for (size_t f = 0; f < frames; ++f)
+                buf[f] = float(m_pos++) / 65536.0f;
+            return frames;
+        }
+
+        virtual bool seek(size_t pos) override { m_pos = pos; return true; }
+
+    private:
+        size_t m_pos = 0;
+    };
+
+    auto l = lol::audio::make_limiter(std::make_shared<ramp>());
+    std::vector<float> buf(1000);
+    for (size_t pos : { 5000, 100, 0 })
+    {
+        CAPTURE(pos);
+        CHECK(l->seek(pos));
+        l->get(buf.data(), buf.size());
+        for (size_t n = 0; n < buf.size(); ++n)
+            CHECK(buf[n] == (pos + n < l->latency() ? 0.0f : float(pos + n - l->latency()) / 65536.0f));
+    }
+}
+
+TEST_CASE("softclip stream")
+{
+    auto src = lol::audio::make_generator<float>([](float *buf, size_t frames)
+    {
+        for (size_t f = 0; f < frames; ++f)
+            buf[f] = (float(f) - 50.0f) / 10.0f;
+        return frames;
+    }, 1, 48000);
+
+    auto s = lol::audio::make_softclip(src);
+    std::vector<float> buf(100);
+    s->get(buf.data(), 100);
+    for (size_t f = 0; f < 100; ++f)
+        CHECK(std::abs(buf[f] - std::tanh((float(f) - 50.0f) / 10.0f)) < 1e-4f);
+}
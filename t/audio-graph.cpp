@@ -0,0 +1,88 @@
+#include <lol/lib/doctest>
+#include <lol/audio/graph>
+
+#include <vector>
+
+using lol::audio::graph;
+
+static auto make_constant(float value)
+{
+    return lol::audio::make_generator<float>([value](float *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames, value);
+        return frames;
+    }, 1, 48000);
+}
+
+// A node that adds a constant to its single input
+static graph<float>::process_fn make_offset(float value)
+{
+    return [value](float const * const *inputs, size_t, float *output, size_t frames)
+    {
+        for (size_t n = 0; n < frames; ++n)
+            output[n] = inputs[0][n] + value;
+    };
+}
+
+TEST_CASE("audio graph: long chain reuses buffers")
+{
+    graph<float> g(1, 48000, 64);
+    auto prev = g.add_stream(make_constant(1.0f));
+    for (int n = 0; n < 50; ++n)
+    {
+        auto node = g.add_node(make_offset(1.0f));
+        g.connect(prev, node);
+        prev = node;
+    }
+    g.set_output(prev);
+
+    CHECK(g.compile());
+    CHECK(g.buffer_count() == 2);
+
+    // Render more frames than the block size
+    std::vector<float> buf(1000);
+    CHECK(g.get(buf.data(), buf.size()) == buf.size());
+    for (auto x : buf)
+        CHECK(x == 51.0f);
+}
+
+TEST_CASE("audio graph: diamond and unused nodes")
+{
+    graph<float> g(1, 48000);
+    auto src = g.add_stream(make_constant(0.25f));
+    auto a = g.add_node(make_offset(0.125f));
+    auto b = g.add_node(make_offset(0.0625f));
+    auto unused = g.add_node(make_offset(1.0f));
+    auto mix = g.add_mixer();
+    g.connect(src, a);
+    g.connect(src, b);
+    g.connect(src, unused);
+    g.connect(a, mix);
+    g.connect(b, mix);
+    g.set_output(mix);
+
+    CHECK(g.compile());
+    CHECK(g.buffer_count() == 3);
+
+    std::vector<float> buf(100);
+    g.get(buf.data(), buf.size());
+    for (auto x : buf)
+        CHECK(x == 0.6875f);
+}
+
+TEST_CASE("audio graph: cycles are rejected")
+{
+    graph<float> g(1, 48000);
+    auto a = g.add_node(make_offset(1.0f));
+    auto b = g.add_node(make_offset(1.0f));
+    g.connect(a, b);
+    g.connect(b, a);
+    g.set_output(b);
+    CHECK(!g.compile());
+
+    // Rendering an invalid graph produces silence
+    std::vector<float> buf(10, 1.0f);
+    g.get(buf.data(), buf.size());
+    for (auto x : buf)
+        CHECK(x == 0.0f);
+}
@@ -0,0 +1,66 @@
+#include <lol/lib/doctest>
+#include <lol/audio/stream>
+
+#include <cmath>
+#include <vector>
+
+using lol::audio::mapper;
+
+TEST_CASE("channel matrix: mono ←→ stereo")
+{
+    CHECK(mapper<float>::matrix(1, 2) == std::vector<float>{ 1.0f, 1.0f });
+    CHECK(mapper<float>::matrix(2, 1) == std::vector<float>{ 0.5f, 0.5f });
+    CHECK(mapper<float>::matrix(2, 1, true) == std::vector<float>{ 1.0f, 1.0f });
+
+    auto m = mapper<float>::matrix(1, 2, true);
+    CHECK(std::abs(m[0] - std::sqrt(0.5f)) < 1e-6f);
+    CHECK(std::abs(m[1] - std::sqrt(0.5f)) < 1e-6f);
+}
+
+TEST_CASE("channel matrix: rows never exceed unity gain")
+{
+    for (auto [in, out] : { std::pair(6, 2), std::pair(8, 2), std::pair(8, 6), std::pair(3, 2) })
+    {
+        CAPTURE(in);
+        CAPTURE(out);
+        auto m = mapper<float>::matrix(in, out);
+        for (int o = 0; o < out; ++o)
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < in; ++i)
+                sum += m[o * in + i];
+            CHECK(sum <= 1.0f + 1e-6f);
+        }
+
+        // LFE never goes to the stereo downmix
+        if (in >= 6 && out == 2)
+            CHECK(m[3] + m[in + 3] == 0.0f);
+    }
+}
+
+TEST_CASE("mapper: 5.1 to stereo")
+{
+    auto src = lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        for (size_t f = 0; f < frames; ++f)
+        {
+            int16_t const frame[] = { 0x1000, -0x1000, 0x2000, 0x7fff, 0, 0 };
+            std::copy(frame, frame + 6, buf + 6 * f);
+        }
+        return frames;
+    }, 6, 48000);
+
+    auto m = lol::audio::make_mapper(src, 2);
+    CHECK(m->channels() == 2);
+
+    std::vector<int16_t> buf(2 * 100);
+    m->get(buf.data(), 100);
+
+    // L = (L + k·C + k·Ls) / (1 + 2k), same for R
+    float k = std::sqrt(0.5f), norm = 1.0f + 2.0f * k;
+    for (size_t f = 0; f < 100; ++f)
+    {
+        CHECK(std::abs(buf[2 * f] - (0x1000 + k * 0x2000) / norm) <= 1.0f);
+        CHECK(std::abs(buf[2 * f + 1] - (-0x1000 + k * 0x2000) / norm) <= 1.0f);
+    }
+}
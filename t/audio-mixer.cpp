@@ -0,0 +1,307 @@
+#include <lol/lib/doctest>
+#include <lol/audio/stream>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// Count the allocations made by the audio classes, which take an allocator
+// for their internal buffers
+static std::atomic<size_t> g_allocations(0);
+
+template<typename T>
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() = default;
+    template<typename U> counting_allocator(counting_allocator<U> const &) {}
+
+    T *allocate(size_t n)
+    {
+        ++g_allocations;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    template<typename U> bool operator ==(counting_allocator<U> const &) const { return true; }
+    template<typename U> bool operator !=(counting_allocator<U> const &) const { return false; }
+};
+
+TEST_CASE("mixer: sum of input streams")
+{
+    auto mixer = std::make_shared<lol::audio::mixer<int16_t>>(2, 48000);
+    mixer->add(lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames * 2, int16_t(0x1000));
+        return frames;
+    }, 2, 48000));
+    mixer->add(lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames * 2, int16_t(0x7000));
+        return frames;
+    }, 2, 48000));
+
+    std::vector<int16_t> buf(256 * 2);
+    CHECK(mixer->get(buf.data(), 256) == 256);
+    for (auto x : buf)
+        CHECK(x == 0x7fff);
+}
+
+TEST_CASE("mixer: short inputs only contribute the frames they produced")
+{
+    auto mixer = std::make_shared<lol::audio::mixer<float>>(1, 48000);
+    mixer->add(lol::audio::make_generator<float>([](float *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames, 0.5f);
+        return frames;
+    }, 1, 48000));
+    mixer->add(lol::audio::make_generator<float>([](float *buf, size_t frames)
+    {
+        size_t const count = std::min(frames, size_t(10));
+        std::fill(buf, buf + count, 0.25f);
+        return count;
+    }, 1, 48000));
+
+    // Whatever the order of the inputs, samples past the end of the short
+    // one must not be mixed twice, even once the scratch buffer is dirty
+    std::vector<float> buf(64);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        mixer->get(buf.data(), 64);
+        CHECK(buf[0] == 0.75f);
+        CHECK(buf[9] == 0.75f);
+        for (size_t n = 10; n < 64; ++n)
+            CHECK(buf[n] == 0.5f);
+    }
+}
+
+TEST_CASE("mixer: no allocations in steady state")
+{
+    auto mixer = std::make_shared<lol::audio::mixer<float, counting_allocator<float>>>(2, 48000);
+    for (int i = 0; i < 8; ++i)
+    {
+        mixer->add(lol::audio::make_generator<float>([i](float *buf, size_t frames)
+        {
+            std::fill(buf, buf + frames * 2, 0.01f * i);
+            return frames;
+        }, 2, 48000));
+    }
+
+    std::vector<float> buf(1024 * 2);
+
+    // The first call may grow the internal buffers
+    mixer->get(buf.data(), 1024);
+
+    size_t before = g_allocations;
+    for (size_t frames : { 1024, 512, 1, 1000, 1024 })
+        mixer->get(buf.data(), frames);
+    CHECK(g_allocations == before);
+
+    // Larger blocks are allowed to allocate once
+    std::vector<float> large(4096 * 2);
+    mixer->get(large.data(), 4096);
+    CHECK(g_allocations == before + 1);
+    mixer->get(large.data(), 4096);
+    CHECK(g_allocations == before + 1);
+}
+
+TEST_CASE("parallel mixer: same output as mixer")
+{
+    lol::thread_pool pool(4);
+    auto m1 = std::make_shared<lol::audio::mixer<int16_t>>(2, 48000);
+    auto m2 = std::make_shared<lol::audio::parallel_mixer<int16_t>>(2, 48000, 1000.0f, pool);
+
+    for (int i = 0; i < 20; ++i)
+    {
+        auto make = [i]()
+        {
+            return lol::audio::make_generator<int16_t>([i, t = 0](int16_t *buf, size_t frames) mutable
+            {
+                for (size_t n = 0; n < frames * 2; ++n)
+                    buf[n] = int16_t((t++ * (i + 1) * 37) % 0x800 - 0x400);
+                return frames;
+            }, 2, 48000);
+        };
+        m1->add(make());
+        m2->add(make());
+    }
+
+    std::vector<int16_t> b1(2 * 512), b2(2 * 512);
+    for (size_t frames : { 512, 100, 512, 1 })
+    {
+        m1->get(b1.data(), frames);
+        m2->get(b2.data(), frames);
+        CHECK(std::equal(b1.begin(), b1.begin() + 2 * frames, b2.begin()));
+    }
+    CHECK(m2->dropped() == 0);
+}
+
+TEST_CASE("parallel mixer: late streams are dropped")
+{
+    if (!lol::thread::has_threads())
+        return;
+
+    // A stream that blocks until the test lets it go, and counts how many
+    // jobs render it at the same time
+    struct gate
+    {
+        void set(bool open)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                is_open = open;
+            }
+            cond.notify_all();
+        }
+
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&]{ return is_open; });
+        }
+
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool is_open = false;
+        std::atomic<int> inside { 0 }, max_inside { 0 }, done { 0 };
+    } g;
+
+    lol::thread_pool pool(2);
+
+    // Blocks last 200 ms and the deadline is half of that, which is more
+    // than enough for the fast stream
+    size_t const frames = 9600;
+    auto m = std::make_shared<lol::audio::parallel_mixer<float>>(1, 48000, 0.5f, pool);
+    m->add(lol::audio::make_generator<float>([](float *buf, size_t count)
+    {
+        std::fill(buf, buf + count, 0.25f);
+        return count;
+    }, 1, 48000));
+    auto slow = lol::audio::make_generator<float>([&](float *buf, size_t count)
+    {
+        int const n = ++g.inside;
+        for (int max = g.max_inside; n > max && !g.max_inside.compare_exchange_weak(max, n); )
+            ;
+        g.wait();
+        std::fill(buf, buf + count, 0.5f);
+        --g.inside;
+        ++g.done;
+        return count;
+    }, 1, 48000);
+    m->add(slow);
+
+    std::vector<float> buf(frames);
+    m->get(buf.data(), frames);
+    CHECK(buf[0] == 0.25f);
+    CHECK(m->dropped() == 1);
+
+    // Removing a stream that is still being rendered is safe, and adding
+    // it back does not start another job while the first one is running
+    m->remove(slow);
+    m->get(buf.data(), frames);
+    CHECK(buf[0] == 0.25f);
+    m->add(slow);
+    m->add(slow);
+    m->get(buf.data(), frames);
+    CHECK(buf[0] == 0.25f);
+    CHECK(m->dropped() == 2);
+    CHECK(g.max_inside.load() == 1);
+
+    // Once the slow stream is done, it is mixed again
+    g.set(true);
+    while (g.done.load() < 1)
+        std::this_thread::yield();
+    m->get(buf.data(), frames);
+    CHECK(buf[0] == 0.75f);
+    CHECK(m->dropped() == 2);
+
+    // Destroying the mixer while a late job still uses it waits for the job
+    g.set(false);
+    m->get(buf.data(), frames);
+    CHECK(m->dropped() == 3);
+    lol::thread opener([&](lol::thread *)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        g.set(true);
+    });
+    m.reset();
+    CHECK(g.done.load() == 3);
+    CHECK(g.max_inside.load() == 1);
+}
+
+TEST_CASE("voice pool: handles and slot reuse")
+{
+    lol::audio::voice_pool<float> pool(1, 48000, 2);
+    auto constant = [](float value)
+    {
+        return lol::audio::make_generator<float>([value](float *buf, size_t frames)
+        {
+            std::fill(buf, buf + frames, value);
+            return frames;
+        }, 1, 48000);
+    };
+
+    auto h1 = pool.add(constant(0.25f));
+    auto h2 = pool.add(constant(0.5f));
+    CHECK(h1);
+    CHECK(h2);
+    CHECK(!pool.add(constant(1.0f)));
+    CHECK(pool.count() == 2);
+
+    // Streams with another channel count are rejected
+    CHECK(pool.remove(h2));
+    CHECK(!pool.add(lol::audio::make_generator<float>([](float *, size_t frames) { return frames; }, 2, 48000)));
+    CHECK(pool.count() == 1);
+    h2 = pool.add(constant(0.5f));
+    CHECK(h2);
+
+    float buf[16];
+    pool.get(buf, 16);
+    CHECK(buf[0] == 0.75f);
+
+    // A stale handle must not remove the voice that reused its slot
+    CHECK(pool.remove(h1));
+    CHECK(!pool.remove(h1));
+    auto h3 = pool.add(constant(0.125f));
+    CHECK(h3.index == h1.index);
+    CHECK(!pool.contains(h1));
+    CHECK(!pool.remove(h1));
+    CHECK(pool.contains(h3));
+
+    pool.get(buf, 16);
+    CHECK(buf[0] == 0.625f);
+}
+
+TEST_CASE("voice pool: finished voices are released without allocating")
+{
+    lol::audio::voice_pool<float, counting_allocator<float>> pool(2, 48000, 64);
+    pool.reserve(256);
+
+    // Pre-build one-shot sounds that last 300 frames
+    std::vector<std::shared_ptr<lol::audio::stream<float>>> sounds;
+    for (int n = 0; n < 200; ++n)
+    {
+        sounds.push_back(lol::audio::make_generator<float>([left = 300](float *buf, size_t frames) mutable
+        {
+            size_t count = std::min(frames, size_t(left));
+            std::fill(buf, buf + count * 2, 0.001f);
+            left -= int(count);
+            return count;
+        }, 2, 48000));
+    }
+
+    std::vector<float> buf(2 * 256);
+    size_t const before = g_allocations;
+    for (int n = 0; n < 200; ++n)
+    {
+        pool.add(sounds[n]);
+        pool.get(buf.data(), 256);
+    }
+    CHECK(g_allocations == before);
+
+    // Only the last sound is still playing
+    CHECK(pool.count() == 1);
+}
@@ -0,0 +1,157 @@
+#include <lol/lib/doctest>
+#include <lol/audio/stream>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// A seekable stereo sine wave source
+class sine : public lol::audio::stream<float>
+{
+public:
+    sine(int frequency, size_t size)
+      : lol::audio::stream<float>(2, frequency), m_size(size)
+    {}
+
+    virtual size_t get(float *buf, size_t frames) override
+    {
+        for (size_t n = 0; n < frames; ++n, ++m_pos)
+        {
+            float x = m_pos < m_size ? std::sin(0.01f * m_pos) : 0.0f;
+            *buf++ = x;
+            *buf++ = -x;
+        }
+        return frames;
+    }
+
+    virtual std::optional<size_t> size() const override { return m_size; }
+    virtual std::optional<size_t> pos() const override { return m_pos; }
+    virtual bool seek(size_t pos) override { m_pos = pos; return true; }
+
+private:
+    size_t m_pos = 0, m_size;
+};
+
+TEST_CASE("resampler: constant signal is preserved")
+{
+    auto src = lol::audio::make_generator<int16_t>([](int16_t *buf, size_t frames)
+    {
+        std::fill(buf, buf + frames, int16_t(1234));
+        return frames;
+    }, 1, 44100);
+    auto r = lol::audio::make_resampler(src, 48000);
+
+    std::vector<int16_t> buf(3000);
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK(r->get(buf.data(), buf.size()) == buf.size());
+        for (auto x : buf)
+            CHECK(x == 1234);
+    }
+}
+
+TEST_CASE("resampler: size, pos and seek")
+{
+    auto r = lol::audio::make_resampler(std::make_shared<sine>(44100, 44100), 48000);
+    CHECK(r->size() == 48000);
+    CHECK(r->pos() == 0);
+
+    std::vector<float> ref(2 * 5000);
+    r->get(ref.data(), 5000);
+    CHECK(r->pos() == 5000);
+
+    // Seeking must give the same samples as continuous playback
+    for (size_t pos : { 4000, 1234, 0, 4999 })
+    {
+        CAPTURE(pos);
+        CHECK(r->seek(pos));
+        CHECK(r->pos() == pos);
+
+        std::vector<float> buf(2 * (5000 - pos));
+        r->get(buf.data(), 5000 - pos);
+        CHECK(std::equal(buf.begin(), buf.end(), ref.begin() + 2 * pos));
+    }
+}
+
+TEST_CASE("resampler: sine wave is reconstructed")
+{
+    // Output frame n matches the input at time (n·M/L + delay); the filter
+    // is slightly longer than 16 frames since this is decimating
+    auto r = lol::audio::make_resampler(std::make_shared<sine>(48000, 100000), 44100);
+    CHECK(r->delay() == 9);
+    std::vector<float> buf(2 * 4000);
+    r->get(buf.data(), 4000);
+    for (size_t n = 0; n < 4000; ++n)
+    {
+        float t = n * 48000.0f / 44100.0f + r->delay();
+        CHECK(std::abs(buf[2 * n] - std::sin(0.01f * t)) < 1e-3f);
+        CHECK(buf[2 * n + 1] == -buf[2 * n]);
+    }
+}
+
+TEST_CASE("resampler: large decimation ratios")
+{
+    // Each output frame advances 24 input frames, more than the base filter
+    // length, and 500 output frames take more than a whole ring buffer
+    auto tone = [](float step)
+    {
+        return lol::audio::make_generator<float>([step, t = 0](float *buf, size_t frames) mutable
+        {
+            for (size_t n = 0; n < frames; ++n)
+                buf[n] = std::sin(step * float(t++));
+            return frames;
+        }, 1, 48000);
+    };
+
+    // A 76 Hz tone is well below the 1 kHz output Nyquist frequency
+    auto low = lol::audio::make_resampler(tone(0.01f), 2000);
+    std::vector<float> buf(500);
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        low->get(buf.data(), buf.size());
+        for (size_t n = 0; n < buf.size(); ++n)
+        {
+            float t = float(pass * 500 + n) * 24.0f + float(low->delay());
+            CHECK(std::abs(buf[n] - std::sin(0.01f * t)) < 1e-2f);
+        }
+    }
+
+    // A 5 kHz tone would alias at 1 kHz; it must be filtered out instead
+    auto high = lol::audio::make_resampler(tone(2.0f * 3.14159265f * 5000.0f / 48000.0f), 2000);
+    float peak = 0.0f;
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        high->get(buf.data(), buf.size());
+        for (size_t n = pass ? 0 : 20; n < buf.size(); ++n)
+            peak = std::max(peak, std::abs(buf[n]));
+    }
+    CHECK(peak < 0.05f);
+}
+
+TEST_CASE("mixer: size, pos and seek through resamplers")
+{
+    auto m = std::make_shared<lol::audio::mixer<float>>(2, 48000);
+    m->add(lol::audio::make_resampler(std::make_shared<sine>(44100, 44100), 48000));
+    m->add(lol::audio::make_resampler(std::make_shared<sine>(32000, 8000), 48000));
+    CHECK(m->size() == 48000);
+    CHECK(m->pos() == 0);
+
+    std::vector<float> ref(2 * 20000);
+    m->get(ref.data(), 20000);
+    CHECK(m->pos() == 20000);
+
+    for (size_t pos : { 15000, 11990, 12000, 100, 0 })
+    {
+        CAPTURE(pos);
+        CHECK(m->seek(pos));
+        CHECK(m->pos() == pos);
+
+        std::vector<float> buf(2 * (20000 - pos));
+        m->get(buf.data(), 20000 - pos);
+        CHECK(std::equal(buf.begin(), buf.end(), ref.begin() + 2 * pos));
+    }
+
+    // Streams without a known size make the mix size unknown
+    m->add(lol::audio::make_generator<float>([](float *, size_t frames) { return frames; }, 2, 48000));
+    CHECK(!m->size());
+}
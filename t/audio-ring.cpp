@@ -0,0 +1,67 @@
+#include <lol/lib/doctest>
+#include <lol/audio/stream>
+
+#include <thread>
+#include <vector>
+
+TEST_CASE("ring stream: underruns and overruns")
+{
+    lol::audio::ring_stream<int16_t> ring(2, 48000, 100);
+    CHECK(ring.capacity() == 128);
+    CHECK(ring.available() == 0);
+
+    std::vector<int16_t> in(2 * 100), out(2 * 100);
+    for (size_t n = 0; n < in.size(); ++n)
+        in[n] = int16_t(n);
+
+    CHECK(ring.write(in.data(), 100) == 100);
+    CHECK(ring.write(in.data(), 100) == 28);
+    CHECK(ring.overruns() == 72);
+    CHECK(ring.available() == 128);
+
+    CHECK(ring.get(out.data(), 100) == 100);
+    CHECK(out == in);
+
+    // Only 28 frames remain, the rest is silence
+    CHECK(ring.get(out.data(), 100) == 100);
+    CHECK(ring.underruns() == 72);
+    for (size_t n = 0; n < out.size(); ++n)
+        CHECK(out[n] == (n < 2 * 28 ? in[n] : 0));
+}
+
+TEST_CASE("ring stream: producer thread")
+{
+    lol::audio::ring_stream<int32_t> ring(1, 48000, 256);
+    size_t const total = 100000;
+
+    std::thread producer([&]()
+    {
+        int32_t buf[37];
+        for (size_t n = 0; n < total; )
+        {
+            size_t count = std::min(size_t(37), total - n);
+            for (size_t i = 0; i < count; ++i)
+                buf[i] = int32_t(n + i + 1);
+            n += ring.write(buf, count);
+            std::this_thread::yield();
+        }
+    });
+
+    // Frames must come out in order; gaps are filled with zeroes
+    int32_t expected = 1;
+    std::vector<int32_t> buf(64);
+    while (size_t(expected) <= total)
+    {
+        ring.get(buf.data(), buf.size());
+        for (auto x : buf)
+        {
+            if (x == 0)
+                continue;
+            CHECK(x == expected);
+            expected = x + 1;
+        }
+    }
+
+    producer.join();
+    CHECK(ring.available() == 0);
+}
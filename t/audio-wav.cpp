@@ -0,0 +1,91 @@
+#include <lol/lib/doctest>
+#include <lol/audio/wav>
+
+#include <cstdio>
+#include <vector>
+
+TEST_CASE("wav: write and read back")
+{
+    char const *path = "audio-wav-test.wav";
+
+    // A stereo ramp rendered by chunks
+    auto src = lol::audio::make_generator<int16_t>([n = 0](int16_t *buf, size_t frames) mutable
+    {
+        for (size_t f = 0; f < frames; ++f, ++n)
+        {
+            *buf++ = int16_t(n);
+            *buf++ = int16_t(-n);
+        }
+        return frames;
+    }, 2, 22050);
+
+    {
+        lol::audio::wav_writer<int16_t> w(path, 2, 22050);
+        CHECK(w.is_open());
+        CHECK(w.write(*src, 10000, 1000) == 10000);
+        CHECK(w.frames() == 10000);
+        CHECK(w.close());
+    }
+
+    auto s = lol::audio::make_wav_stream<int16_t>(path);
+    REQUIRE(s);
+    CHECK(s->channels() == 2);
+    CHECK(s->frequency() == 22050);
+    CHECK(s->size() == 10000);
+    REQUIRE(s->data());
+    CHECK(s->data()[2] == 1);
+
+    std::vector<int16_t> buf(2 * 100);
+    CHECK(s->seek(9950));
+    CHECK(s->get(buf.data(), 100) == 50);
+    CHECK(s->pos() == 10000);
+    CHECK(buf[0] == 9950);
+    CHECK(buf[1] == -9950);
+    CHECK(buf[100] == 0);
+
+    // Read the same file as floats
+    auto f = lol::audio::make_wav_stream<float>(path);
+    REQUIRE(f);
+    CHECK(!f->data());
+    std::vector<float> fbuf(2 * 100);
+    CHECK(f->seek(1000));
+    CHECK(f->get(fbuf.data(), 100) == 100);
+    CHECK(fbuf[0] == lol::audio::sample::convert<int16_t, float>(1000));
+    CHECK(fbuf[1] == lol::audio::sample::convert<int16_t, float>(-1000));
+
+    std::remove(path);
+}
+
+TEST_CASE("wav: 24-bit files")
+{
+    char const *path = "audio-wav-test24.wav";
+
+    // Mono, 8000 Hz, 24-bit PCM, three samples
+    std::vector<uint8_t> data =
+    {
+        'R', 'I', 'F', 'F', 45, 0, 0, 0, 'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0, 0x40, 0x1f, 0, 0,
+        0xc0, 0x5d, 0, 0, 3, 0, 24, 0,
+        'd', 'a', 't', 'a', 9, 0, 0, 0,
+        0x00, 0x00, 0x80, 0xff, 0xff, 0xff, 0xff, 0xff, 0x7f,
+    };
+    CHECK(lol::file::write(path, data));
+
+    auto s = lol::audio::make_wav_stream<int16_t>(path);
+    REQUIRE(s);
+    CHECK(s->size() == 3);
+
+    int16_t buf[3];
+    CHECK(s->get(buf, 3) == 3);
+    CHECK(buf[0] == -0x8000);
+    CHECK(buf[1] == -0x0001);
+    CHECK(buf[2] == 0x7fff);
+
+    std::remove(path);
+}
+
+TEST_CASE("wav: invalid files")
+{
+    CHECK(!lol::audio::make_wav_stream<float>("this-file-does-not-exist.wav"));
+    CHECK(!lol::audio::wav::parse((uint8_t const *)"RIFF\0\0\0\0WAVE", 12));
+}
@@ -0,0 +1,167 @@
+//
+//  Audio pipeline benchmarks
+//
+//  Measure the throughput of the audio stream classes, in frames per
+//  second, and print the results as JSON on the standard output.
+//  Usage: bench-audio [seconds per benchmark]
+//
+
+#include <lol/audio/convolver>
+#include <lol/audio/dynamics>
+#include <lol/audio/stream>
+#include <lol/thread>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static float g_duration = 0.25f;
+static bool g_first = true;
+
+template<typename T> static char const *name_of();
+template<> char const *name_of<uint8_t>() { return "uint8"; }
+template<> char const *name_of<int16_t>() { return "int16"; }
+template<> char const *name_of<int32_t>() { return "int32"; }
+template<> char const *name_of<float>() { return "float"; }
+template<> char const *name_of<double>() { return "double"; }
+
+// A cheap source that replays a block of noise
+template<typename T>
+static auto make_source(size_t channels, int frequency)
+{
+    std::vector<float> noise(4096 * channels);
+    for (auto &x : noise)
+        x = float(std::rand()) / float(RAND_MAX) * 1.6f - 0.8f;
+
+    std::vector<T> data(noise.size());
+    lol::audio::sample::convert_n(noise.data(), data.data(), data.size());
+
+    return lol::audio::make_generator<T>([data, channels](T *buf, size_t frames)
+    {
+        for (size_t done = 0; done < frames; )
+        {
+            size_t count = std::min(frames - done, data.size() / channels);
+            std::copy(data.begin(), data.begin() + count * channels, buf + done * channels);
+            done += count;
+        }
+        return frames;
+    }, channels, frequency);
+}
+
+// Pull blocks from a stream until the time budget is spent
+template<typename T>
+static void run(std::string const &name, std::string const &params,
+                lol::audio::stream<T> &s, size_t block = 512)
+{
+    std::vector<T> buf(block * s.channels());
+
+    // Warm up caches and internal buffers
+    for (int n = 0; n < 4; ++n)
+        s.get(buf.data(), block);
+
+    lol::timer t;
+    size_t frames = 0;
+    float seconds = 0.0f;
+    do
+    {
+        for (int n = 0; n < 16; ++n, frames += block)
+            s.get(buf.data(), block);
+        seconds = t.poll();
+    }
+    while (seconds < g_duration);
+
+    std::printf("%s    { \"name\": \"%s\", \"params\": { %s }, \"frames\": %zu, \"seconds\": %g, \"frames_per_second\": %g }",
+                g_first ? "" : ",\n", name.c_str(), params.c_str(), frames, seconds, frames / seconds);
+    g_first = false;
+}
+
+template<typename FROM, typename TO>
+static void bench_converter()
+{
+    auto c = lol::audio::make_converter<TO>(make_source<FROM>(2, 48000));
+    run("converter", std::string("\"from\": \"") + name_of<FROM>() + "\", \"to\": \"" + name_of<TO>() + "\"", *c);
+}
+
+static void bench_mapper(size_t in, size_t out)
+{
+    auto m = lol::audio::make_mapper(make_source<float>(in, 48000), out);
+    run("mapper", "\"in\": " + std::to_string(in) + ", \"out\": " + std::to_string(out), *m);
+}
+
+static void bench_resampler(int in_rate, int out_rate)
+{
+    auto r = lol::audio::make_resampler(make_source<float>(2, in_rate), out_rate);
+    run("resampler", "\"in_rate\": " + std::to_string(in_rate) + ", \"out_rate\": " + std::to_string(out_rate), *r);
+}
+
+static void bench_dynamics()
+{
+    auto s = lol::audio::make_softclip(make_source<float>(2, 48000));
+    run("softclip", "", *s);
+
+    auto l = lol::audio::make_limiter(make_source<float>(2, 48000), 0.5f);
+    run("limiter", "", *l);
+}
+
+static void bench_convolver(float ir_seconds, size_t block)
+{
+    std::vector<float> ir(size_t(ir_seconds * 48000));
+    for (size_t n = 0; n < ir.size(); ++n)
+        ir[n] = float(std::rand()) / float(RAND_MAX) * std::exp(-3.0f * n / ir.size());
+
+    auto c = lol::audio::make_convolver(make_source<float>(2, 48000), ir, 1, block);
+    run("convolver", "\"ir_seconds\": " + std::to_string(ir_seconds) + ", \"block\": " + std::to_string(block), *c);
+}
+
+template<typename M>
+static void bench_mixer(char const *name, std::shared_ptr<M> m, size_t inputs)
+{
+    for (size_t n = 0; n < inputs; ++n)
+        m->add(make_source<float>(2, 48000));
+    run(name, "\"inputs\": " + std::to_string(inputs), *m);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        g_duration = float(std::atof(argv[1]));
+
+    std::printf("{\n  \"benchmarks\": [\n");
+
+    bench_converter<int16_t, float>();
+    bench_converter<float, int16_t>();
+    bench_converter<uint8_t, float>();
+    bench_converter<float, uint8_t>();
+    bench_converter<int16_t, uint8_t>();
+    bench_converter<int32_t, float>();
+    bench_converter<float, double>();
+    bench_converter<double, float>();
+
+    bench_mapper(1, 2);
+    bench_mapper(2, 1);
+    bench_mapper(6, 2);
+    bench_mapper(8, 6);
+
+    bench_resampler(44100, 48000);
+    bench_resampler(48000, 44100);
+    bench_resampler(22050, 48000);
+    bench_resampler(32000, 48000);
+
+    bench_dynamics();
+
+    bench_convolver(0.1f, 256);
+    bench_convolver(3.0f, 256);
+    bench_convolver(3.0f, 1024);
+
+    for (size_t inputs = 1; inputs <= 256; inputs *= 2)
+        bench_mixer("mixer", std::make_shared<lol::audio::mixer<float>>(2, 48000), inputs);
+
+    if (lol::thread::has_threads())
+        for (size_t inputs = 1; inputs <= 256; inputs *= 4)
+            bench_mixer("parallel_mixer", std::make_shared<lol::audio::parallel_mixer<float>>(2, 48000, 1000.0f), inputs);
+
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+//
+//  Threading benchmarks
+//
+//  Measure the throughput of the thread-safe queues under contention, in
+//  items per second, and the overhead of scheduling small jobs, in
+//  nanoseconds per job. Results are printed as JSON on the standard output.
+//  Usage: bench-threading [items per producer]
+//
+
+#include <lol/thread>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+static size_t g_items = 200000;
+static bool g_first = true;
+
+// Move items from the producers to the consumers through the queue
+template<typename Q>
+static void run(char const *name, size_t producers, size_t consumers)
+{
+    auto q = std::make_unique<Q>();
+    size_t const total = producers * g_items;
+
+    lol::timer t;
+    {
+        std::vector<std::unique_ptr<lol::thread>> threads;
+        for (size_t p = 0; p < producers; ++p)
+            threads.push_back(std::make_unique<lol::thread>([&](lol::thread *)
+            {
+                for (size_t i = 0; i < g_items; ++i)
+                    q->push(int(i));
+            }));
+        for (size_t c = 0; c < consumers; ++c)
+            threads.push_back(std::make_unique<lol::thread>([&, c](lol::thread *)
+            {
+                // Spread the remainder over the first consumers
+                size_t count = total / consumers + (c < total % consumers ? 1 : 0);
+                for (size_t i = 0; i < count; ++i)
+                    (void)q->pop();
+            }));
+    }
+    float seconds = t.get();
+
+    std::printf("%s    { \"name\": \"%s\", \"params\": { \"producers\": %zu, \"consumers\": %zu }, \"items\": %zu, \"seconds\": %g, \"items_per_second\": %g }",
+                g_first ? "" : ",\n", name, producers, consumers, total, seconds, total / seconds);
+    g_first = false;
+}
+
+// Same as above, with producers and consumers moving batches of items
+template<typename Q>
+static void run_batched(char const *name, size_t producers, size_t consumers, size_t batch)
+{
+    auto q = std::make_unique<Q>();
+    size_t const total = producers * g_items;
+
+    lol::timer t;
+    {
+        std::vector<std::unique_ptr<lol::thread>> threads;
+        for (size_t p = 0; p < producers; ++p)
+            threads.push_back(std::make_unique<lol::thread>([&](lol::thread *)
+            {
+                std::vector<int> buf(batch);
+                for (size_t i = 0; i < g_items; i += batch)
+                {
+                    size_t count = std::min(batch, g_items - i);
+                    q->push_n(buf.begin(), buf.begin() + count);
+                }
+            }));
+        for (size_t c = 0; c < consumers; ++c)
+            threads.push_back(std::make_unique<lol::thread>([&, c](lol::thread *)
+            {
+                std::vector<int> buf(batch);
+                size_t count = total / consumers + (c < total % consumers ? 1 : 0);
+                for (size_t i = 0; i < count; )
+                    i += q->pop_n(buf.begin(), std::min(batch, count - i));
+            }));
+    }
+    float seconds = t.get();
+
+    std::printf("%s    { \"name\": \"%s\", \"params\": { \"producers\": %zu, \"consumers\": %zu, \"batch\": %zu }, \"items\": %zu, \"seconds\": %g, \"items_per_second\": %g }",
+                g_first ? "" : ",\n", name, producers, consumers, batch, total, seconds, total / seconds);
+    g_first = false;
+}
+
+// Schedule empty jobs on a job system in frames of two dependent stages,
+// and report the average wall-clock cost of each job
+static void run_jobs(size_t workers, size_t frames, size_t jobs_per_stage)
+{
+    lol::job_system jobs(workers);
+    size_t const total = frames * jobs_per_stage * 2;
+
+    lol::timer t;
+    for (size_t f = 0; f < frames; ++f)
+    {
+        lol::job_counter a, b;
+        jobs.run_n(jobs_per_stage, [](size_t) {}, &a);
+        jobs.run_n(jobs_per_stage, [](size_t) {}, &b, &a);
+        jobs.wait_for_counter(b);
+    }
+    int64_t ns = t.get_ns();
+
+    std::printf("%s    { \"name\": \"job_system\", \"params\": { \"workers\": %zu, \"jobs_per_stage\": %zu }, \"jobs\": %zu, \"seconds\": %g, \"ns_per_job\": %g }",
+                g_first ? "" : ",\n", jobs.size(), jobs_per_stage, total, double(ns) * 1e-9, double(ns) / double(total));
+    g_first = false;
+}
+
+// The same workload with one lol::thread per job, for comparison
+static void run_threads(size_t frames, size_t jobs_per_stage)
+{
+    size_t const total = frames * jobs_per_stage * 2;
+
+    lol::timer t;
+    for (size_t f = 0; f < frames; ++f)
+        for (int stage = 0; stage < 2; ++stage)
+        {
+            std::vector<std::unique_ptr<lol::thread>> threads;
+            for (size_t j = 0; j < jobs_per_stage; ++j)
+                threads.push_back(std::make_unique<lol::thread>([](lol::thread *) {}));
+        }
+    int64_t ns = t.get_ns();
+
+    std::printf("%s    { \"name\": \"thread_per_job\", \"params\": { \"jobs_per_stage\": %zu }, \"jobs\": %zu, \"seconds\": %g, \"ns_per_job\": %g }",
+                g_first ? "" : ",\n", jobs_per_stage, total, double(ns) * 1e-9, double(ns) / double(total));
+    g_first = false;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        g_items = size_t(std::atol(argv[1]));
+
+    std::printf("{\n  \"benchmarks\": [\n");
+
+    for (size_t n : { 1, 2, 4, 8, 16 })
+    {
+        run<lol::queue<int, 1024>>("queue", n, n);
+        run<lol::mpmc_queue<int, 1024>>("mpmc_queue", n, n);
+        run_batched<lol::queue<int, 1024>>("queue_batched", n, n, 64);
+    }
+
+    for (size_t n : { 0, 1, 2, 4, 8 })
+        run_jobs(n, 1000, 128);
+    run_threads(20, 128);
+
+    std::printf("\n  ]\n}\n");
+    return 0;
+}
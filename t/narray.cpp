@@ -0,0 +1,258 @@
+#include <lol/lib/doctest>
+#include <lol/narray>
+#include <lol/parallel>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+// Fills new storage with a pattern, to tell which elements were initialised
+template<typename T>
+struct pattern_allocator
+{
+    using value_type = T;
+
+    pattern_allocator() = default;
+    template<typename U> pattern_allocator(pattern_allocator<U> const &) {}
+
+    T *allocate(size_t n)
+    {
+        ++allocations;
+        T *p = std::allocator<T>().allocate(n);
+        std::memset(static_cast<void *>(p), 0xab, n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    template<typename U> bool operator ==(pattern_allocator<U> const &) const { return true; }
+    template<typename U> bool operator !=(pattern_allocator<U> const &) const { return false; }
+
+    static inline int allocations = 0;
+};
+
+TEST_CASE("narray: storage is aligned")
+{
+    for (int n : { 1, 3, 17, 1000 })
+    {
+        lol::array2d<uint8_t> a(n, 3);
+        CHECK(uintptr_t(a.data()) % 64 == 0);
+
+        lol::narray<float, 2, lol::aligned_allocator<float, 256>> b(n, 3);
+        CHECK(uintptr_t(b.data()) % 256 == 0);
+    }
+
+    lol::narray<int, 1, std::allocator<int>> c(10);
+    CHECK(c.size() == 10);
+    CHECK(c[9] == 0);
+}
+
+TEST_CASE("narray: custom allocators and uninitialised resize")
+{
+    pattern_allocator<uint8_t>::allocations = 0;
+    lol::narray<uint8_t, 2, pattern_allocator<uint8_t>> a;
+
+    a.resize(4, 4);
+    CHECK(pattern_allocator<uint8_t>::allocations == 1);
+    CHECK(a(3, 3) == 0);
+
+    a.clear();
+    a.resize_uninitialized(4, 4);
+    CHECK(pattern_allocator<uint8_t>::allocations == 1);
+
+    a.resize_uninitialized(8, 8);
+    CHECK(pattern_allocator<uint8_t>::allocations == 2);
+    CHECK(a(0, 0) == 0);
+    CHECK(a(7, 7) == 0xab);
+}
+
+TEST_CASE("narray: padded rows")
+{
+    lol::array2d<int> a;
+    a.set_row_padding(16);
+    a.resize(10, 3);
+    CHECK(a.sizes() == lol::ivec2(10, 3));
+    CHECK(a.size() == 30);
+    CHECK(a.pitch() == 16);
+    CHECK(a.storage_size() == 48);
+    CHECK(&a(9, 2) == a.data() + 2 * 16 + 9);
+    CHECK(&a(lol::ivec2(4, 1)) == a.data() + 16 + 4);
+
+    // Padding shows up when iterating, and is ignored by algorithms
+    for (auto &x : a)
+        x = 1000;
+    for (int j = 0; j < 3; ++j)
+        for (int i = 0; i < 10; ++i)
+            a(i, j) = 1;
+    CHECK(lol::parallel::reduce(a, 0, [](int x, int y) { return x + y; }) == 30);
+
+    auto s = a.span();
+    CHECK(s.strides() == lol::vec_t<size_t, 2>(1, 16));
+    CHECK(!s.is_contiguous());
+    CHECK(&s(9, 2) == &a(9, 2));
+
+    lol::array2d<int> b(10, 3);
+    lol::parallel::transform(a, b, [](int x) { return x + 1; });
+    CHECK(b.pitch() == 10);
+    CHECK(std::accumulate(begin(b), end(b), 0) == 60);
+
+    // Copies keep the layout, moves steal the storage
+    lol::array2d<int> c = a;
+    CHECK(c.pitch() == 16);
+    CHECK(c(9, 2) == 1);
+    CHECK(c.data() != a.data());
+
+    int *data = c.data();
+    lol::array2d<int> d = std::move(c);
+    CHECK(d.data() == data);
+    CHECK(d.row_padding() == 16);
+}
+
+TEST_CASE("narray: resize keeps elements in storage order")
+{
+    lol::narray<std::shared_ptr<int>, 1> a(3);
+    for (int i = 0; i < 3; ++i)
+        a[i] = std::make_shared<int>(i);
+    std::weak_ptr<int> last = a[2];
+
+    a.resize(100);
+    CHECK(*a[0] == 0);
+    CHECK(*a[2] == 2);
+    CHECK(!a[99]);
+
+    a.resize(2);
+    CHECK(last.expired());
+}
+
+TEST_CASE("narray span: sub-regions")
+{
+    lol::array2d<int> a(8, 6);
+    for (int j = 0; j < 6; ++j)
+        for (int i = 0; i < 8; ++i)
+            a(i, j) = j * 10 + i;
+    CHECK(a.span().is_contiguous());
+
+    auto tile = a.span().subspan(lol::ivec2(2, 1), lol::ivec2(3, 4));
+    CHECK(tile.sizes() == lol::ivec2(3, 4));
+    CHECK(!tile.is_contiguous());
+    CHECK(tile(0, 0) == 12);
+    CHECK(tile(2, 3) == 44);
+    CHECK(&tile(lol::ivec2(1, 2)) == &a(3, 3));
+
+    // Writes go through to the array, and algorithms only visit the region
+    lol::parallel::for_each(tile, [](int &x) { x = -x; });
+    CHECK(a(2, 1) == -12);
+    CHECK(a(1, 1) == 11);
+    CHECK(a(5, 1) == 15);
+    CHECK(lol::parallel::reduce(tile, 0, [](int x, int y) { return x + y; })
+          == -(3 * (10 + 20 + 30 + 40) + 4 * (2 + 3 + 4)));
+
+    // Full-width regions are contiguous
+    CHECK(a.span().subspan(lol::ivec2(0, 2), lol::ivec2(8, 3)).is_contiguous());
+    CHECK(a.span().subspan(lol::ivec2(2, 2), lol::ivec2(3, 1)).is_contiguous());
+
+    lol::array2d<int> const &c = a;
+    auto ctile = c.span().subspan(lol::ivec2(0, 5), lol::ivec2(2, 1));
+    CHECK(ctile(1, 0) == 51);
+}
+
+TEST_CASE("narray span: slices")
+{
+    lol::narray<int, 3> a(4, 3, 2);
+    std::iota(begin(a), end(a), 0);
+
+    auto row = a.span().slice(1, 2);
+    CHECK(row.sizes() == lol::ivec2(4, 2));
+    CHECK(row(3, 1) == a(3, 2, 1));
+
+    auto column = a.span().slice(2, 1).slice(0, 3);
+    CHECK(column.sizes() == lol::vec_t<int, 1>(3));
+    CHECK(column.strides() == lol::vec_t<size_t, 1>(4));
+    CHECK(!column.is_contiguous());
+    CHECK(column(2) == a(3, 2, 1));
+    CHECK(lol::parallel::reduce(column, 0, [](int x, int y) { return x + y; })
+          == a(3, 0, 1) + a(3, 1, 1) + a(3, 2, 1));
+}
+
+TEST_CASE("narray span: transposed and permuted views")
+{
+    lol::array2d<float> a(5, 3);
+    for (int j = 0; j < 3; ++j)
+        for (int i = 0; i < 5; ++i)
+            a(i, j) = float(j * 10 + i);
+
+    auto t = a.span().transpose();
+    CHECK(t.sizes() == lol::ivec2(3, 5));
+    CHECK(!t.is_contiguous());
+    CHECK(t(2, 4) == a(4, 2));
+
+    // Transposing through transform, then back
+    lol::array2d<float> b(3, 5);
+    lol::parallel::transform(t, b.span(), [](float x) { return x; });
+    CHECK(b(2, 4) == 24.f);
+    CHECK(b.span().transpose()(4, 2) == 24.f);
+
+    lol::narray<int, 3> c(2, 3, 4);
+    std::iota(begin(c), end(c), 0);
+    auto p = c.span().permute(lol::ivec3(2, 0, 1));
+    CHECK(p.sizes() == lol::ivec3(4, 2, 3));
+    CHECK(p(3, 1, 2) == c(1, 2, 3));
+    CHECK(p.permute(lol::ivec3(1, 2, 0)).is_contiguous());
+}
+
+TEST_CASE("narray span: iterating over views")
+{
+    lol::array2d<int> a;
+    a.set_row_padding(8);
+    a.resize(5, 4);
+    for (auto &x : a)
+        x = -1;
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 5; ++i)
+            a(i, j) = j * 10 + i;
+
+    // Spans skip the row padding
+    std::vector<int> all(begin(a.span()), end(a.span()));
+    CHECK(all.size() == 20);
+    CHECK(std::count(all.begin(), all.end(), -1) == 0);
+
+    // Sub-regions are visited in row-major order
+    std::vector<int> seen;
+    for (int x : a.span().subspan(lol::ivec2(1, 2), lol::ivec2(3, 2)))
+        seen.push_back(x);
+    CHECK(seen == std::vector<int> { 21, 22, 23, 31, 32, 33 });
+
+    // So are transposed views and slices
+    lol::array2d<int> const &c = a;
+    auto t = c.span().subspan(lol::ivec2(0, 0), lol::ivec2(2, 3)).transpose();
+    CHECK(std::vector<int>(begin(t), end(t)) == std::vector<int> { 0, 10, 20, 1, 11, 21 });
+    auto column = a.span().slice(0, 4);
+    CHECK(std::accumulate(begin(column), end(column), 0) == 4 * 4 + 60);
+
+    // Writes go through
+    for (auto &x : a.span().subspan(lol::ivec2(4, 0), lol::ivec2(1, 4)))
+        x = 0;
+    CHECK(a(4, 3) == 0);
+    CHECK(a(3, 3) == 33);
+
+    // Empty views have no elements
+    auto empty = a.span().subspan(lol::ivec2(2, 2), lol::ivec2(0, 2));
+    CHECK(begin(empty) == end(empty));
+}
+
+TEST_CASE("narray span: views of existing data")
+{
+    int data[12];
+    std::iota(data, data + 12, 0);
+
+    lol::span2d<int> s(data, lol::ivec2(4, 3));
+    CHECK(s.is_contiguous());
+    CHECK(s(1, 2) == 9);
+
+    // Every other column
+    lol::span2d<int> t(data, lol::ivec2(2, 3), lol::vec_t<size_t, 2>(2, 4));
+    CHECK(t(1, 2) == 10);
+}
@@ -0,0 +1,84 @@
+#include <lol/lib/doctest>
+#include <lol/parallel>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+TEST_CASE("parallel: for_each and transform")
+{
+    lol::narray<int, 3> a(37, 41, 43);
+    for (size_t i = 0; i < a.size(); ++i)
+        a[i] = int(i);
+
+    lol::parallel::for_each(a, [](int &x) { x *= 2; });
+    for (size_t i = 0; i < a.size(); ++i)
+        CHECK(a[i] == int(2 * i));
+
+    lol::narray<float, 3> b(37, 41, 43);
+    lol::parallel::transform(a, b, [](int x) { return float(x) + 0.5f; });
+    for (size_t i = 0; i < b.size(); ++i)
+        CHECK(b[i] == float(2 * i) + 0.5f);
+}
+
+TEST_CASE("parallel: reduce")
+{
+    lol::array2d<uint8_t> a(1000, 1000);
+    for (size_t i = 0; i < a.size(); ++i)
+        a[i] = uint8_t(i % 251);
+
+    int64_t expected = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+        expected += a[i];
+
+    auto sum = lol::parallel::reduce(a, int64_t(0), [](int64_t x, int64_t y) { return x + y; });
+    CHECK(sum == expected);
+
+    // The initial value is only used once
+    auto sum2 = lol::parallel::reduce(a.span(), int64_t(10), [](int64_t x, int64_t y) { return x + y; });
+    CHECK(sum2 == expected + 10);
+}
+
+TEST_CASE("parallel: empty arrays")
+{
+    for (auto sizes : { lol::ivec2(0, 10), lol::ivec2(10, 0), lol::ivec2(0, 0) })
+    {
+        lol::array2d<float> a(sizes);
+        std::atomic<int> calls { 0 };
+
+        lol::parallel::for_each(a, [&](float &) { ++calls; });
+        lol::parallel::for_each_tile(a.span(), [&](lol::ivec2, lol::ivec2) { ++calls; });
+        CHECK(calls.load() == 0);
+
+        lol::array2d<int> b(sizes);
+        lol::parallel::transform(a, b, [](float x) { return int(x); });
+        CHECK(lol::parallel::reduce(a, 1.5f, [](float x, float y) { return x + y; }) == 1.5f);
+    }
+}
+
+TEST_CASE("parallel: tiles cover the array exactly once")
+{
+    lol::array2d<float> a(1000, 300);
+    auto tile = lol::parallel::tile_size<float, 2>(a.sizes());
+    CHECK(tile[0] * tile[1] * sizeof(float) <= lol::parallel::tile_bytes);
+    CHECK(tile[0] * sizeof(float) >= 64);
+
+    std::vector<std::atomic<int>> hits(a.size());
+    std::atomic<int> tiles { 0 };
+    lol::parallel::for_each_tile(a.span(), [&](lol::ivec2 origin, lol::ivec2 size)
+    {
+        ++tiles;
+        for (int y = origin.y; y < origin.y + size.y; ++y)
+            for (int x = origin.x; x < origin.x + size.x; ++x)
+                hits[y * 1000 + x].fetch_add(1);
+    });
+
+    CHECK(tiles.load() == ((1000 + tile[0] - 1) / tile[0]) * ((300 + tile[1] - 1) / tile[1]));
+    for (auto &n : hits)
+        CHECK(n.load() == 1);
+
+    // Explicit tile size
+    tiles = 0;
+    lol::parallel::for_each_tile(a.span(), [&](lol::ivec2, lol::ivec2) { ++tiles; }, lol::ivec2(100, 100));
+    CHECK(tiles.load() == 10 * 3);
+}
@@ -0,0 +1,86 @@
+#include <lol/lib/doctest>
+#include <lol/profile>
+#include <lol/thread>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+static size_t occurrences(std::string const &s, std::string const &what)
+{
+    size_t ret = 0;
+    for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1))
+        ++ret;
+    return ret;
+}
+
+TEST_CASE("profile: clock is monotonic with nanosecond ticks")
+{
+    int64_t t0 = lol::profile::now();
+    int64_t t1 = lol::profile::now();
+    CHECK(t1 >= t0);
+
+    lol::timer t;
+    t.wait(0.002f);
+    CHECK(lol::profile::now() - t1 >= 2000000);
+}
+
+TEST_CASE("profile: zones and counters from several threads")
+{
+    lol::profile::clear();
+    lol::profile::thread_name("main \"thread\"");
+
+    {
+        LOL_PROFILE_ZONE("outer");
+        LOL_PROFILE_ZONE("inner");
+        LOL_PROFILE_COUNTER("voices", 12);
+    }
+
+    {
+        std::vector<std::unique_ptr<lol::thread>> threads;
+        for (int n = 0; n < 4; ++n)
+            threads.push_back(std::make_unique<lol::thread>([](lol::thread *)
+            {
+                lol::profile::thread_name("worker");
+                // Enough events to need several chunks
+                for (int i = 0; i < 5000; ++i)
+                    LOL_PROFILE_ZONE("job");
+            }));
+    }
+
+    CHECK(lol::profile::count() == 3 + 4 * 5000);
+
+    std::string json = lol::profile::chrome_trace();
+    CHECK(json.find("{\"traceEvents\":[") == 0);
+    CHECK(occurrences(json, "\"name\":\"job\"") == 20000);
+    CHECK(occurrences(json, "\"name\":\"outer\"") == 1);
+    CHECK(occurrences(json, "\"ph\":\"C\"") == 1);
+    CHECK(occurrences(json, "\"args\":{\"value\":12}") == 1);
+    CHECK(occurrences(json, "\"args\":{\"name\":\"worker\"}") == 4);
+    CHECK(json.find("main \\\"thread\\\"") != std::string::npos);
+    CHECK(occurrences(json, "{") == occurrences(json, "}"));
+
+    lol::profile::clear();
+    CHECK(lol::profile::count() == 0);
+}
+
+TEST_CASE("profile: each thread keeps its most recent events")
+{
+    lol::profile::clear();
+
+    size_t const total = lol::profile::capacity + 1000;
+    for (size_t i = 0; i < total; ++i)
+        LOL_PROFILE_COUNTER("n", double(i));
+
+    // The oldest events were overwritten instead of using more memory
+    CHECK(lol::profile::count() == lol::profile::capacity);
+
+    std::string json = lol::profile::chrome_trace();
+    CHECK(occurrences(json, "\"name\":\"n\"") == lol::profile::capacity);
+    CHECK(json.find("\"args\":{\"value\":999}") == std::string::npos);
+    CHECK(json.find("\"args\":{\"value\":1000}") != std::string::npos);
+    CHECK(json.find("\"args\":{\"value\":" + std::to_string(total - 1) + "}") != std::string::npos);
+
+    lol::profile::clear();
+    CHECK(lol::profile::count() == 0);
+}
@@ -0,0 +1,194 @@
+#include <lol/lib/doctest>
+#include <lol/task>
+
+// Coroutines need C++20; there is nothing to test otherwise
+#if LOL_HAS_COROUTINES
+
+#include <atomic>
+#include <exception>
+#include <thread>
+#include <vector>
+
+static lol::task<int> answer()
+{
+    co_return 42;
+}
+
+static lol::task<int> add(int a, int b)
+{
+    int x = co_await answer();
+    co_return x - 42 + a + b;
+}
+
+static lol::task<int> count_down(int n)
+{
+    // Symmetric transfer keeps the stack flat through long chains of
+    // awaits, at least when the compiler emits tail calls
+    if (!n)
+        co_return 0;
+    int x = co_await count_down(n - 1);
+    co_return x + 1;
+}
+
+TEST_CASE("task: awaiting other tasks")
+{
+    CHECK(lol::sync_wait(answer()) == 42);
+    CHECK(lol::sync_wait(add(3, 4)) == 7);
+    CHECK(lol::sync_wait(count_down(1000)) == 1000);
+}
+
+TEST_CASE("task: void tasks and executors")
+{
+    lol::thread_pool pool(2);
+    std::atomic<int> hits { 0 };
+    auto const main_id = std::this_thread::get_id();
+
+    auto body = [&]() -> lol::task<>
+    {
+        co_await lol::resume_on(pool);
+        if (pool.size())
+            CHECK(std::this_thread::get_id() != main_id);
+        hits.fetch_add(1);
+    };
+
+    lol::sync_wait(body());
+    lol::sync_wait(body(), &pool);
+    CHECK(hits.load() == 2);
+}
+
+TEST_CASE("task: executors set with on()")
+{
+    lol::thread_pool pool(2);
+    auto const main_id = std::this_thread::get_id();
+
+    auto where = [&]() -> lol::task<bool>
+    {
+        co_return std::this_thread::get_id() != main_id;
+    };
+
+    CHECK(!lol::sync_wait(where()));
+    if (pool.size())
+    {
+        CHECK(lol::sync_wait(where().on(pool)));
+        CHECK(lol::sync_wait(where().on(pool), &pool));
+    }
+}
+
+TEST_CASE("task: delays")
+{
+    lol::thread_pool pool(2);
+
+    auto sleeper = [&](float seconds) -> lol::task<float>
+    {
+        lol::timer t;
+        co_await lol::delay(seconds);
+        co_return t.poll();
+    };
+
+    CHECK(lol::sync_wait(sleeper(0.02f)) >= 0.02f);
+    CHECK(lol::sync_wait(sleeper(0.02f), &pool) >= 0.02f);
+    CHECK(lol::sync_wait(sleeper(0.0f)) >= 0.0f);
+}
+
+TEST_CASE("task: popping from a queue")
+{
+    lol::queue<int, 8> q;
+    lol::thread_pool pool(2);
+    int const count = 10000;
+
+    auto consumer = [&]() -> lol::task<long>
+    {
+        long sum = 0;
+        for (int i = 0; i < count; ++i)
+            sum += co_await lol::async_pop(q);
+        co_return sum;
+    };
+
+    auto producer = [&]
+    {
+        for (int i = 1; i <= count; ++i)
+            q.push(i);
+    };
+
+    // Resumed inline by the producer thread, then on the pool
+    {
+        lol::thread t([&](lol::thread *) { producer(); });
+        CHECK(lol::sync_wait(consumer()) == long(count) * (count + 1) / 2);
+    }
+    {
+        lol::thread t([&](lol::thread *) { producer(); });
+        CHECK(lol::sync_wait(consumer(), &pool) == long(count) * (count + 1) / 2);
+    }
+}
+
+// A coroutine that starts eagerly and is destroyed by hand
+struct detached
+{
+    struct promise_type
+    {
+        detached get_return_object() { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+TEST_CASE("task: destroying a coroutine waiting on a queue")
+{
+    lol::queue<int> q;
+    int got = -1;
+
+    auto waiter = [&]() -> detached { got = co_await lol::async_pop(q); };
+    auto d = waiter();
+    CHECK(!d.handle.done());
+
+    // The element stays in the queue since nobody waits for it any more
+    d.handle.destroy();
+    q.push(42);
+    CHECK(got == -1);
+    int x = 0;
+    CHECK(q.try_pop(x));
+    CHECK(x == 42);
+}
+
+TEST_CASE("task: several tasks waiting on one queue")
+{
+    lol::queue<int> q;
+    lol::thread_pool pool(2);
+    std::atomic<long> sum { 0 };
+
+    auto consumer = [&]() -> lol::task<>
+    {
+        for (int x; (x = co_await lol::async_pop(q)) >= 0; )
+            sum.fetch_add(x);
+    };
+
+    auto all = [&]() -> lol::task<>
+    {
+        co_await consumer();
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 3; ++i)
+        threads.emplace_back([&]{ lol::sync_wait(all(), &pool); });
+    for (int i = 1; i <= 1000; ++i)
+        q.push(i);
+    for (int i = 0; i < 3; ++i)
+        q.push(-1);
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(sum.load() == 1000 * 1001 / 2);
+}
+
+#else
+
+TEST_CASE("task: skipped, coroutines need C++20")
+{
+    MESSAGE("lol::task is not available with this compiler");
+}
+
+#endif
@@ -0,0 +1,440 @@
+#include <lol/lib/doctest>
+#include <lol/thread>
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+TEST_CASE("work deque: owner and thieves see every item once")
+{
+    lol::work_deque<int, 1024> d;
+    std::vector<int> items(100000);
+    std::iota(items.begin(), items.end(), 0);
+    std::vector<std::atomic<int>> seen(items.size());
+
+    std::atomic<bool> done { false };
+    auto thief = [&](lol::thread *)
+    {
+        while (!done.load() || d.size())
+            if (int *x = d.steal())
+                seen[*x].fetch_add(1);
+    };
+
+    {
+        lol::thread t1(thief), t2(thief);
+        for (auto &x : items)
+        {
+            while (!d.push(&x))
+                if (int *y = d.pop())
+                    seen[*y].fetch_add(1);
+            if (x % 3 == 0)
+                if (int *y = d.pop())
+                    seen[*y].fetch_add(1);
+        }
+        while (int *y = d.pop())
+            seen[*y].fetch_add(1);
+        done = true;
+    }
+
+    for (auto &n : seen)
+        CHECK(n.load() == 1);
+}
+
+TEST_CASE("thread pool: futures and continuations")
+{
+    lol::thread_pool pool(4);
+
+    auto f = pool.submit([]{ return 20; });
+    auto g = f.then([](int x) { return x + 1; }).then([](int x) { return 2 * x; });
+    CHECK(g.get() == 42);
+    CHECK(f.ready());
+
+    // Continuation added after the result is ready
+    CHECK(f.then([](int x) { return x * 3; }).get() == 60);
+
+    std::atomic<int> counter { 0 };
+    auto v = pool.submit([&]{ counter.fetch_add(1); });
+    v.then([&]{ counter.fetch_add(10); }).wait();
+    CHECK(counter.load() == 11);
+}
+
+TEST_CASE("thread pool: parallel_for visits every index once")
+{
+    lol::thread_pool pool(4);
+
+    std::vector<std::atomic<int>> hits(100000);
+    pool.parallel_for(0, hits.size(), [&](size_t i) { hits[i].fetch_add(1); });
+    for (auto &n : hits)
+        CHECK(n.load() == 1);
+
+    // Nested parallel loops help instead of deadlocking
+    std::atomic<size_t> sum { 0 };
+    pool.parallel_for(0, 16, [&](size_t i)
+    {
+        pool.parallel_for(0, 1000, [&](size_t j) { sum.fetch_add(i * 1000 + j); });
+    });
+    CHECK(sum.load() == 16000 * 15999 / 2);
+}
+
+TEST_CASE("thread pool: many small jobs from workers")
+{
+    lol::thread_pool pool(3);
+
+    std::atomic<int> counter { 0 };
+    std::vector<lol::future<void>> jobs;
+    for (int i = 0; i < 100; ++i)
+        jobs.push_back(pool.submit([&]
+        {
+            // Spawn from a worker so that the jobs land in its own deque
+            for (int k = 0; k < 100; ++k)
+                pool.run([&]{ counter.fetch_add(1); });
+        }));
+    for (auto &j : jobs)
+        j.wait();
+
+    // Wait for the inner jobs as well
+    while (counter.load() < 10000)
+        pool.run_one();
+    CHECK(counter.load() == 10000);
+}
+
+TEST_CASE("thread pool: no workers runs inline")
+{
+    lol::thread_pool pool(0);
+    CHECK(pool.size() == 0);
+
+    int x = 0;
+    auto f = pool.submit([&]{ return ++x; });
+    CHECK(f.ready());
+    CHECK(f.get() == 1);
+
+    pool.parallel_for(0, 10, [&](size_t i) { x += int(i); });
+    CHECK(x == 46);
+}
+
+TEST_CASE("job system: counters and dependencies")
+{
+    lol::job_system jobs(4);
+    std::atomic<int> stage_a { 0 }, stage_b { 0 };
+    std::atomic<bool> ordered { true };
+    lol::job_counter a, b;
+
+    jobs.run_n(100, [&](size_t) { stage_a.fetch_add(1); }, &a);
+    jobs.run_n(100, [&](size_t)
+    {
+        ordered = ordered && stage_a.load() == 100;
+        stage_b.fetch_add(1);
+    }, &b, &a, 7);
+
+    jobs.wait_for_counter(b);
+    CHECK(a.done());
+    CHECK(b.done());
+    CHECK(stage_a.load() == 100);
+    CHECK(stage_b.load() == 100);
+    CHECK(ordered.load());
+
+    // Counters can be reused once back to zero
+    jobs.run([&]{ stage_a.fetch_add(1); }, &a);
+    jobs.wait_for_counter(a);
+    CHECK(stage_a.load() == 101);
+}
+
+TEST_CASE("job system: jobs waiting for other jobs")
+{
+    // With a single worker, nested waits only make progress by helping
+    lol::job_system jobs(1);
+    std::atomic<int> leaves { 0 };
+    lol::job_counter outer;
+
+    jobs.run_n(20, [&](size_t)
+    {
+        lol::job_counter inner;
+        jobs.run_n(10, [&](size_t) { leaves.fetch_add(1); }, &inner);
+        jobs.wait_for_counter(inner);
+    }, &outer);
+    jobs.wait_for_counter(outer);
+    CHECK(leaves.load() == 200);
+}
+
+TEST_CASE("job system: no workers runs inline")
+{
+    lol::job_system jobs(0);
+    CHECK(jobs.size() == 0);
+
+    int x = 0;
+    lol::job_counter c, d;
+    jobs.run([&]{ x += 1; }, &c);
+    CHECK(x == 1);
+    CHECK(c.done());
+    jobs.run([&]{ x *= 10; }, &d, &c);
+    CHECK(x == 10);
+    jobs.wait_for_counter(d);
+}
+
+TEST_CASE("mpmc queue: move-only elements")
+{
+    lol::mpmc_queue<std::unique_ptr<int>, 4> q;
+    CHECK(q.try_push(std::make_unique<int>(1)));
+    CHECK(q.try_push(std::make_unique<int>(2)));
+    CHECK(q.size() == 2);
+
+    std::unique_ptr<int> p;
+    CHECK(q.try_pop(p));
+    CHECK(*p == 1);
+    CHECK(*q.pop() == 2);
+    CHECK(!q.try_pop(p));
+
+    // Full queue
+    for (int i = 0; i < 4; ++i)
+        CHECK(q.try_push(std::make_unique<int>(i)));
+    auto extra = std::make_unique<int>(5);
+    CHECK(!q.try_push(std::move(extra)));
+    CHECK(extra);
+
+    // Remaining elements are destroyed with the queue
+}
+
+TEST_CASE("mpmc queue: elements without a default constructor")
+{
+    struct handle
+    {
+        explicit handle(int n) : value(std::make_unique<int>(n)) {}
+        std::unique_ptr<int> value;
+    };
+    static_assert(!std::is_default_constructible_v<handle>);
+
+    lol::mpmc_queue<handle, 4> q;
+    q.push(handle(1));
+    CHECK(q.try_push(handle(2)));
+    CHECK(q.try_push(handle(3)));
+
+    CHECK(*q.pop().value == 1);
+    auto h = q.try_pop();
+    REQUIRE(h);
+    CHECK(*h->value == 2);
+    CHECK(*q.try_pop()->value == 3);
+    CHECK(!q.try_pop());
+}
+
+TEST_CASE("mpmc queue: many producers and consumers")
+{
+    size_t const producers = 4, consumers = 4, count = 20000;
+
+    lol::mpmc_queue<size_t, 64> q;
+    std::vector<std::atomic<int>> seen(producers * count);
+    {
+        std::vector<std::unique_ptr<lol::thread>> threads;
+        for (size_t p = 0; p < producers; ++p)
+            threads.push_back(std::make_unique<lol::thread>([&, p](lol::thread *)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    q.push(p * count + i);
+            }));
+        for (size_t c = 0; c < consumers; ++c)
+            threads.push_back(std::make_unique<lol::thread>([&](lol::thread *)
+            {
+                for (size_t i = 0; i < producers * count / consumers; ++i)
+                    seen[q.pop()].fetch_add(1);
+            }));
+    }
+
+    for (auto &n : seen)
+        CHECK(n.load() == 1);
+    CHECK(q.size() == 0);
+}
+
+TEST_CASE("queue: batch push and pop")
+{
+    lol::queue<int, 8> q;
+
+    // Fill part of the ring so that batches wrap around
+    std::vector<int> in { 0, 1, 2, 3, 4, 5 };
+    CHECK(q.try_push_n(in.begin(), in.end()) == 6);
+    std::vector<int> out(8, -1);
+    CHECK(q.try_pop_n(out.begin(), 5) == 5);
+    CHECK(out[4] == 4);
+    CHECK(q.size() == 1);
+
+    // Only seven more elements fit
+    std::vector<int> more { 10, 11, 12, 13, 14, 15, 16, 17, 18 };
+    CHECK(q.try_push_n(more.begin(), more.end()) == 7);
+    CHECK(q.size() == 8);
+
+    // Blocking calls need threads, but do not block here
+    auto pop_all = [&](auto out)
+    {
+        return lol::thread::has_threads() ? q.pop_n(out, 100) : q.try_pop_n(out, 100);
+    };
+
+    std::vector<int> all;
+    CHECK(pop_all(std::back_inserter(all)) == 8);
+    CHECK(all == std::vector<int> { 5, 10, 11, 12, 13, 14, 15, 16 });
+    CHECK(q.try_pop_n(out.begin(), 4) == 0);
+
+    // Fill the queue again; without threads, nobody could ever make room
+    // for more, so push_n() gives up instead of blocking forever
+    CHECK(q.push_n(more.begin(), more.begin() + 8) == 8);
+    if (!lol::thread::has_threads())
+        CHECK(q.push_n(more.begin() + 8, more.end()) == 0);
+    all.clear();
+    CHECK(pop_all(std::back_inserter(all)) == 8);
+}
+
+TEST_CASE("queue: batches between threads")
+{
+    if (!lol::thread::has_threads())
+        return;
+
+    size_t const producers = 3, count = 30000;
+
+    lol::queue<size_t, 256> q;
+    std::vector<int> seen(producers * count);
+    {
+        std::vector<std::unique_ptr<lol::thread>> threads;
+        for (size_t p = 0; p < producers; ++p)
+            threads.push_back(std::make_unique<lol::thread>([&, p](lol::thread *)
+            {
+                std::vector<size_t> batch(100);
+                for (size_t i = 0; i < count; i += batch.size())
+                {
+                    for (size_t k = 0; k < batch.size(); ++k)
+                        batch[k] = p * count + i + k;
+                    q.push_n(batch.begin(), batch.end());
+                }
+            }));
+
+        std::vector<size_t> buf(64);
+        for (size_t done = 0; done < producers * count; )
+        {
+            size_t n = q.pop_n(buf.begin(), buf.size());
+            for (size_t k = 0; k < n; ++k)
+                ++seen[buf[k]];
+            done += n;
+        }
+    }
+
+    for (auto n : seen)
+        CHECK(n == 1);
+}
+
+TEST_CASE("timer: integer nanoseconds and double seconds")
+{
+    lol::timer t;
+    int64_t a = t.poll_ns();
+    int64_t b = t.poll_ns();
+    CHECK(a >= 0);
+    CHECK(b >= a);
+
+    t.wait(0.003f);
+    double s = t.poll<double>();
+    CHECK(s >= 0.003);
+    CHECK(t.get<double>() >= s);
+    CHECK(t.poll() < s);
+}
+
+TEST_CASE("timer: wait_until does not wake up early")
+{
+    lol::timer t;
+    for (int frame = 1; frame <= 10; ++frame)
+    {
+        int64_t deadline = frame * int64_t(2000000);
+        t.wait_until(deadline);
+        int64_t now = t.poll_ns();
+        CHECK(now >= deadline);
+        // Generous bound for loaded machines
+        CHECK(now < deadline + 20000000);
+    }
+
+    // Deadlines in the past return immediately
+    t.wait_until(0);
+}
+
+TEST_CASE("timer: ticks")
+{
+    double freq = lol::timer::ticks_per_second();
+    CHECK(freq > 0.0);
+
+    uint64_t t0 = lol::timer::ticks();
+    lol::timer t;
+    t.wait(0.01f);
+    uint64_t t1 = lol::timer::ticks();
+    double elapsed = double(t1 - t0) / freq;
+    CHECK(elapsed >= 0.009);
+    CHECK(elapsed < 0.2);
+}
+
+TEST_CASE("mutex: unnamed mutexes have no statistics")
+{
+    lol::mutex m;
+    CHECK(m.stats() == nullptr);
+    std::lock_guard<lol::mutex> lock(m);
+    CHECK(!m.try_lock());
+}
+
+template<typename M>
+static void hammer(M &m, int &counter, int threads, int count)
+{
+    std::vector<std::unique_ptr<lol::thread>> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.push_back(std::make_unique<lol::thread>([&](lol::thread *)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                std::lock_guard<M> lock(m);
+                ++counter;
+            }
+        }));
+}
+
+TEST_CASE("mutex: named mutexes record statistics")
+{
+    lol::mutex m("test mutex");
+    int counter = 0;
+    hammer(m, counter, 4, 20000);
+    CHECK(counter == 80000);
+
+    CHECK(m.try_lock());
+    m.unlock();
+
+    auto info = m.stats()->get();
+    CHECK(info.name == "test mutex");
+    CHECK(info.acquisitions == 80001);
+    CHECK(info.contended <= info.acquisitions);
+    CHECK(info.wait >= 0.0);
+    CHECK(info.max_hold >= 0.0);
+
+    bool found = false;
+    for (auto const &i : lol::lock_stats::all())
+        found |= i.name == "test mutex";
+    CHECK(found);
+    CHECK(lol::lock_stats::dump().find("test mutex") != std::string::npos);
+}
+
+TEST_CASE("mutex: registry forgets destroyed mutexes")
+{
+    {
+        lol::adaptive_mutex m("short-lived");
+        m.lock();
+        m.unlock();
+    }
+    for (auto const &i : lol::lock_stats::all())
+        CHECK(i.name != "short-lived");
+}
+
+TEST_CASE("adaptive mutex: mutual exclusion")
+{
+    lol::adaptive_mutex m;
+    int counter = 0;
+    hammer(m, counter, 8, 20000);
+    CHECK(counter == 160000);
+
+    lol::adaptive_mutex n("adaptive");
+    hammer(n, counter, 4, 10000);
+    CHECK(counter == 200000);
+    CHECK(n.stats()->get().acquisitions == 40000);
+}